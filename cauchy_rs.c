@@ -110,10 +110,10 @@ static bool CpuHasSSSE3 = false;
 #define CPUID_EBX_AVX2    0x00000020
 #define CPUID_ECX_SSSE3   0x00000200
 
-static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type)
+static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type, const unsigned int cpu_info_subleaf)
 {
 #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86))
-    __cpuid((int *) cpu_info, cpu_info_type);
+    __cpuidex((int *) cpu_info, cpu_info_type, cpu_info_subleaf);
 #else //if defined(HAVE_CPUID)
     cpu_info[0] = cpu_info[1] = cpu_info[2] = cpu_info[3] = 0;
 # ifdef __i386__
@@ -132,17 +132,17 @@ static void _cpuid(unsigned int cpu_info[4U], const unsigned int cpu_info_type)
     __asm__ __volatile__ ("xchgl %%ebx, %k1; cpuid; xchgl %%ebx, %k1" :
                           "=a" (cpu_info[0]), "=&r" (cpu_info[1]),
                           "=c" (cpu_info[2]), "=d" (cpu_info[3]) :
-                          "0" (cpu_info_type), "2" (0U));
+                          "0" (cpu_info_type), "2" (cpu_info_subleaf));
 # elif defined(__x86_64__)
     __asm__ __volatile__ ("xchgq %%rbx, %q1; cpuid; xchgq %%rbx, %q1" :
                           "=a" (cpu_info[0]), "=&r" (cpu_info[1]),
                           "=c" (cpu_info[2]), "=d" (cpu_info[3]) :
-                          "0" (cpu_info_type), "2" (0U));
+                          "0" (cpu_info_type), "2" (cpu_info_subleaf));
 # else
     __asm__ __volatile__ ("cpuid" :
                           "=a" (cpu_info[0]), "=b" (cpu_info[1]),
                           "=c" (cpu_info[2]), "=d" (cpu_info[3]) :
-                          "0" (cpu_info_type), "2" (0U));
+                          "0" (cpu_info_type), "2" (cpu_info_subleaf));
 # endif
 #endif
 }
@@ -168,6 +168,52 @@ static void checkLinuxARMNeonCapabilities( bool& cpuHasNeon ) {
 #endif
 #endif // defined(GF_ARM)
 
+// L2 data cache size used to pick tile sizes, a default unless detected below
+static unsigned CpuL2CacheBytes = 256 * 1024;
+
+#if !defined(GF_ARM)
+// Read the L2 data cache size from CPUID leaf 4, or the AMD extended leaf
+static void gf_cache_init(void) {
+    unsigned int cpu_info[4];
+    unsigned int maxLeaf, level, type, bytes, ii;
+
+    _cpuid(cpu_info, 0, 0);
+    maxLeaf = cpu_info[0];
+
+    if (maxLeaf >= 4) {
+        for (ii = 0; ii < 16; ++ii) {
+            _cpuid(cpu_info, 4, ii);
+            type = cpu_info[0] & 0x1f;
+            if (type == 0) {
+                break;
+            }
+            if (type == 2) {
+                continue; // Instruction cache
+            }
+            level = (cpu_info[0] >> 5) & 0x7;
+            bytes = (((cpu_info[1] >> 22) & 0x3ff) + 1) *
+                    (((cpu_info[1] >> 12) & 0x3ff) + 1) *
+                    ((cpu_info[1] & 0xfff) + 1) *
+                    (cpu_info[2] + 1);
+            if (level == 2) {
+                CpuL2CacheBytes = bytes;
+            }
+        }
+        if (ii > 0) {
+            return;
+        }
+    }
+
+    _cpuid(cpu_info, 0x80000000, 0);
+    if (cpu_info[0] >= 0x80000006) {
+        _cpuid(cpu_info, 0x80000006, 0);
+        if (cpu_info[2] >> 16) {
+            CpuL2CacheBytes = (cpu_info[2] >> 16) * 1024;
+        }
+    }
+}
+#endif // GF_ARM
+
 static void gf_architecture_init(void) {
     unsigned int cpu_info[4];
 #if defined(GF_NEON)
@@ -197,14 +243,16 @@ static void gf_architecture_init(void) {
 
 #if !defined(GF_ARM)
 
-    _cpuid(cpu_info, 1);
+    _cpuid(cpu_info, 1, 0);
     CpuHasSSSE3 = ((cpu_info[2] & CPUID_ECX_SSSE3) != 0);
 
 #if defined(GF_AVX2)
-    _cpuid(cpu_info, 7);
+    _cpuid(cpu_info, 7, 0);
     CpuHasAVX2 = ((cpu_info[1] & CPUID_EBX_AVX2) != 0);
 #endif // GF_AVX2
 
+    gf_cache_init();
+
     // When AVX2 and SSSE3 are unavailable, Siamese takes 4x longer to decode
     // and 2.6x longer to encode.  Encoding requires a lot more simple XOR ops
     // so it is still pretty fast.  Decoding is usually really quick because
@@ -967,14 +1015,16 @@ void gf_addset_mem(void * __restrict vz, const void * __restrict vx, const void
     }
 }
 
-void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int bytes) {
+void gf_mul_mem_table(void * __restrict vz, const void * __restrict vx, const gf_mul_table* mul, int bytes) {
     M128 * __restrict z16 = (M128 *)(vz);
     const M128 * __restrict x16 = (const M128 *)(vx);
 
     uint8_t * __restrict z1;
     uint8_t * __restrict x1;
-    uint8_t * __restrict table;
+    const uint8_t * __restrict table;
     int offset, four;
+    const uint8_t y = mul->Y;
+
     // Use a single if-statement to handle special cases
     if (y <= 1) {
         if (y == 0) {
@@ -991,8 +1041,8 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
     if (bytes >= 16 && CpuHasNeon) {
         // Partial product tables; see above
 	kernel_fpu_begin();
-        const M128 table_lo_y = vld1q_u8((uint8_t*)(GFContext.MM128.TABLE_LO_Y + y));
-        const M128 table_hi_y = vld1q_u8((uint8_t*)(GFContext.MM128.TABLE_HI_Y + y));
+        const M128 table_lo_y = vld1q_u8((uint8_t*)(mul->Lo128));
+        const M128 table_hi_y = vld1q_u8((uint8_t*)(mul->Hi128));
 
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         const M128 clr_mask = vdupq_n_u8(0x0f);
@@ -1020,8 +1070,8 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
 	M256 * __restrict z32;
 	M256 * __restrict x32;
         // Partial product tables; see above
-        table_lo_y = *(GFContext.MM256.TABLE_LO_Y + y);
-        table_hi_y = *(GFContext.MM256.TABLE_HI_Y + y);
+        table_lo_y = *(mul->Lo256);
+        table_hi_y = *(mul->Hi256);
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         clr_mask = vector_set_256(0x0f);
 
@@ -1052,8 +1102,8 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
     if (bytes >= 16 && CpuHasSSSE3) {
         M128 table_lo_y, table_hi_y, clr_mask;
         // Partial product tables; see above
-        table_lo_y = *(GFContext.MM128.TABLE_LO_Y + y);
-        table_hi_y = *(GFContext.MM128.TABLE_HI_Y + y);
+        table_lo_y = *(mul->Lo128);
+        table_hi_y = *(mul->Hi128);
 
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         clr_mask = vector_set(0x0f);
@@ -1079,7 +1129,7 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
 
     z1 = (uint8_t*)(z16);
     x1 = (uint8_t*)(x16);
-    table = GFContext.GF_MUL_TABLE + ((unsigned)y << 8);
+    table = mul->Scalar;
     // Handle blocks of 8 bytes
     while (bytes >= 8) {
         uint64_t * __restrict z8 = (uint64_t *)(z1);
@@ -1118,14 +1168,124 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
     }
 }
 
-void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx, int bytes) {
+void gf_mul_mem_table_inplace(void * vz, const gf_mul_table* mul, int bytes) {
+    M128 * z16 = (M128 *)(vz);
+    uint8_t * z1;
+    const uint8_t * table;
+    const uint8_t y = mul->Y;
+
+    // Use a single if-statement to handle special cases
+    if (y <= 1) {
+        if (y == 0) {
+            memset(vz, 0, bytes);
+        }
+        return;
+    }
+
+#if defined(GF_ARM)
+#if defined(GF_NEON)
+    if (bytes >= 16 && CpuHasNeon) {
+        // Partial product tables; see above
+	kernel_fpu_begin();
+        const M128 table_lo_y = vld1q_u8((uint8_t*)(mul->Lo128));
+        const M128 table_hi_y = vld1q_u8((uint8_t*)(mul->Hi128));
+
+        // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
+        const M128 clr_mask = vdupq_n_u8(0x0f);
+        kernel_fpu_end();
+        // Each vector is loaded before it is overwritten
+        do {
+	    kernel_fpu_begin();
+            M128 x0 = vld1q_u8((uint8_t*)z16);
+            M128 l0 = vandq_u8(x0, clr_mask);
+            x0 = vshrq_n_u8(x0, 4);
+            M128 h0 = vandq_u8(x0, clr_mask);
+            l0 = vqtbl1q_u8(table_lo_y, l0);
+            h0 = vqtbl1q_u8(table_hi_y, h0);
+            vst1q_u8((uint8_t*)z16, veorq_u8(l0, h0));
+            kernel_fpu_end();
+            bytes -= 16, ++z16;
+        } while (bytes >= 16);
+    }
+#endif
+#else
+# if defined(GF_AVX2)
+    if (bytes >= 32 && CpuHasAVX2) {
+        M256 table_lo_y, table_hi_y, clr_mask;
+        M256 * z32;
+        // Partial product tables; see above
+        table_lo_y = *(mul->Lo256);
+        table_hi_y = *(mul->Hi256);
+        // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
+        clr_mask = vector_set_256(0x0f);
+
+        z32 = (M256 *)(vz);
+
+        // Each vector is loaded before it is overwritten
+        do {
+            M256 x0, l0, h0;
+            x0 = *(z32);
+            l0 = vector_and_256(x0, clr_mask);
+            kernel_fpu_begin();
+            x0 = vector_srli_epi64_256(x0, 4);
+            h0 = vector_and_256(x0, clr_mask);
+            l0 = vector_shuffle_epi8_256(table_lo_y, l0);
+            h0 = vector_shuffle_epi8_256(table_hi_y, h0);
+            kernel_fpu_end();
+            *(z32) = vector_xor_256(l0, h0);
+
+            bytes -= 32, ++z32;
+        } while (bytes >= 32);
+
+        z16 = (M128 *)(z32);
+    }
+# endif // GF_AVX2
+    if (bytes >= 16 && CpuHasSSSE3) {
+        M128 table_lo_y, table_hi_y, clr_mask;
+        // Partial product tables; see above
+        table_lo_y = *(mul->Lo128);
+        table_hi_y = *(mul->Hi128);
+
+        // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
+        clr_mask = vector_set(0x0f);
+
+        // Each vector is loaded before it is overwritten
+        do {
+            M128 x0, l0, h0;
+            x0 = *(z16);
+            l0 = vector_and(x0, clr_mask);
+            kernel_fpu_begin();
+            x0 = vector_srli_epi64(x0, 4);
+            h0 = vector_and(x0, clr_mask);
+            l0 = vector_shuffle_epi8(table_lo_y, l0);
+            h0 = vector_shuffle_epi8(table_hi_y, h0);
+            kernel_fpu_end();
+            *(z16) = vector_xor(l0, h0);
+
+            bytes -= 16, ++z16;
+        } while (bytes >= 16);
+    }
+#endif
+
+    // Handle the remaining bytes one at a time
+    z1 = (uint8_t*)(z16);
+    table = mul->Scalar;
+    while (bytes > 0) {
+        *z1 = table[*z1];
+        --bytes, ++z1;
+    }
+}
+
+void gf_muladd_mem_table(void * __restrict vz, const gf_mul_table* mul, const void * __restrict vx, int bytes) {
     M128 * __restrict z16 = (M128 *)(vz);
     const M128 * __restrict x16 = (const M128 *)(vx);
 
     uint8_t * __restrict z1;
     uint8_t * __restrict x1;
-    uint8_t * __restrict table;
+    const uint8_t * __restrict table;
     int four, offset;
+    const uint8_t y = mul->Y;
+
     // Use a single if-statement to handle special cases
     if (y <= 1) {
         if (y == 1) {
@@ -1139,8 +1299,8 @@ void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx,
     if (bytes >= 16 && CpuHasNeon) {
         // Partial product tables; see above
 	kernel_fpu_begin();
-        const M128 table_lo_y = vld1q_u8((uint8_t*)(GFContext.MM128.TABLE_LO_Y + y));
-        const M128 table_hi_y = vld1q_u8((uint8_t*)(GFContext.MM128.TABLE_HI_Y + y));
+        const M128 table_lo_y = vld1q_u8((uint8_t*)(mul->Lo128));
+        const M128 table_hi_y = vld1q_u8((uint8_t*)(mul->Hi128));
 
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         const M128 clr_mask = vdupq_n_u8(0x0f);
@@ -1173,8 +1333,8 @@ void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx,
 	M256 * __restrict z32;
         M256 * __restrict x32;
 	unsigned count, i;
-        table_lo_y = *(GFContext.MM256.TABLE_LO_Y + y);
-        table_hi_y = *(GFContext.MM256.TABLE_HI_Y + y);
+        table_lo_y = *(mul->Lo256);
+        table_hi_y = *(mul->Hi256);
 
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         clr_mask = vector_set_256(0x0f);
@@ -1241,8 +1401,8 @@ void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx,
     if (bytes >= 16 && CpuHasSSSE3) {
         // Partial product tables; see above
         M128 table_lo_y, table_hi_y, clr_mask;
-        table_lo_y = *(GFContext.MM128.TABLE_LO_Y + y);
-        table_hi_y = *(GFContext.MM128.TABLE_HI_Y + y);
+        table_lo_y = *(mul->Lo128);
+        table_hi_y = *(mul->Hi128);
 
         // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
         clr_mask = vector_set(0x0f);
@@ -1304,7 +1464,7 @@ void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx,
 
     z1 = (uint8_t*)(z16);
     x1 = (uint8_t*)(x16);
-    table = GFContext.GF_MUL_TABLE + ((unsigned)y << 8);
+    table = mul->Scalar;
     
 
     // Handle blocks of 8 bytes
@@ -1345,6 +1505,126 @@ void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx,
     }
 }
 
+#if defined(GF_ARM)
+void gf_muladdset_mem_table(void * __restrict vz, const void * __restrict vw, const gf_mul_table* mul, const void * __restrict vx, int bytes) {
+    // Product first, then the sum; both have NEON kernels
+    gf_mul_mem_table(vz, vx, mul, bytes);
+    gf_add_mem(vz, vw, bytes);
+}
+#else // GF_ARM
+void gf_muladdset_mem_table(void * __restrict vz, const void * __restrict vw, const gf_mul_table* mul, const void * __restrict vx, int bytes) {
+    M128 * __restrict z16 = (M128 *)(vz);
+    const M128 * __restrict w16 = (const M128 *)(vw);
+    const M128 * __restrict x16 = (const M128 *)(vx);
+
+    uint8_t * __restrict z1;
+    const uint8_t * __restrict w1;
+    const uint8_t * __restrict x1;
+    const uint8_t * __restrict table;
+    int ii;
+    const uint8_t y = mul->Y;
+
+    // Use a single if-statement to handle special cases
+    if (y <= 1) {
+        if (y == 0) {
+            memcpy(vz, vw, bytes);
+        } else {
+            gf_addset_mem(vz, vw, vx, bytes);
+        }
+        return;
+    }
+
+#if defined(GF_AVX2)
+    if (bytes >= 32 && CpuHasAVX2) {
+        M256 table_lo_y, table_hi_y, clr_mask;
+        M256 * __restrict z32;
+        const M256 * __restrict w32;
+        const M256 * __restrict x32;
+        // Partial product tables; see above
+        table_lo_y = *(mul->Lo256);
+        table_hi_y = *(mul->Hi256);
+        // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
+        clr_mask = vector_set_256(0x0f);
+
+        z32 = (M256 *)(z16);
+        w32 = (const M256 *)(w16);
+        x32 = (const M256 *)(x16);
+
+        // Handle multiples of 32 bytes
+        do {
+            M256 x0, l0, h0, p0;
+            // See above comments for details
+            x0 = *(x32);
+            l0 = vector_and_256(x0, clr_mask);
+            kernel_fpu_begin();
+            x0 = vector_srli_epi64_256(x0, 4);
+            h0 = vector_and_256(x0, clr_mask);
+            l0 = vector_shuffle_epi8_256(table_lo_y, l0);
+            h0 = vector_shuffle_epi8_256(table_hi_y, h0);
+            kernel_fpu_end();
+            p0 = vector_xor_256(l0, h0);
+            *(z32) = vector_xor_256(p0, *(w32));
+
+            bytes -= 32, ++w32, ++x32, ++z32;
+        } while (bytes >= 32);
+
+        z16 = (M128 *)(z32);
+        w16 = (const M128 *)(w32);
+        x16 = (const M128 *)(x32);
+    }
+#endif // GF_AVX2
+    if (bytes >= 16 && CpuHasSSSE3) {
+        M128 table_lo_y, table_hi_y, clr_mask;
+        // Partial product tables; see above
+        table_lo_y = *(mul->Lo128);
+        table_hi_y = *(mul->Hi128);
+
+        // clr_mask = 0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f
+        clr_mask = vector_set(0x0f);
+
+        // Handle multiples of 16 bytes
+        do {
+            M128 x0, l0, h0, p0;
+            // See above comments for details
+            x0 = *(x16);
+            l0 = vector_and(x0, clr_mask);
+            kernel_fpu_begin();
+            x0 = vector_srli_epi64(x0, 4);
+            h0 = vector_and(x0, clr_mask);
+            l0 = vector_shuffle_epi8(table_lo_y, l0);
+            h0 = vector_shuffle_epi8(table_hi_y, h0);
+            kernel_fpu_end();
+            p0 = vector_xor(l0, h0);
+            *(z16) = vector_xor(p0, *(w16));
+
+            bytes -= 16, ++w16, ++x16, ++z16;
+        } while (bytes >= 16);
+    }
+
+    z1 = (uint8_t*)(z16);
+    w1 = (const uint8_t*)(w16);
+    x1 = (const uint8_t*)(x16);
+    table = mul->Scalar;
+
+    // Handle the remaining bytes
+    for (ii = 0; ii < bytes; ++ii) {
+        z1[ii] = w1[ii] ^ table[x1[ii]];
+    }
+}
+#endif // GF_ARM
+
+void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int bytes) {
+    gf_mul_table mul;
+    gf_mul_table_init(&mul, y);
+    gf_mul_mem_table(vz, vx, &mul, bytes);
+}
+
+void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx, int bytes) {
+    gf_mul_table mul;
+    gf_mul_table_init(&mul, y);
+    gf_muladd_mem_table(vz, &mul, vx, bytes);
+}
+
 void gf_memswap(void * __restrict vx, void * __restrict vy, int bytes) {
     int eight, four, offset;
     uint8_t * __restrict x1;
@@ -1462,9 +1742,17 @@ void gf_memswap(void * __restrict vx, void * __restrict vy, int bytes) {
 //-----------------------------------------------------------------------------
 // Initialization
 
+// Defined with the specialized encoders below
+static void FixedEncoderInit(void);
+
 int cauchy_init(void){
     // Return error code from GF(256) init if required
-    return gf_init();
+    int ret = gf_init();
+
+    if (!ret){
+        FixedEncoderInit();
+    }
+    return ret;
 }
 
 
@@ -1508,93 +1796,1471 @@ static FORCE_INLINE unsigned char GetMatrixElement(unsigned char x_i, unsigned c
 }
 
 
-//-----------------------------------------------------------------------------
-// Encoding
-
-void cauchy_rs_encode_block(
-    cauchy_encoder_params params, // Encoder parameters
-    cauchy_block* originals,      // Array of pointers to original blocks
-    int recoveryBlockIndex,      // Return value from cauchy_get_recovery_block_index()
-    void* recoveryBlock)         // Output recovery block
-{   
-    uint8_t x_0, x_i, y_0, y_j, matrixElement;
-    int j;
-    // If only one block of input data,
-    if (params.OriginalCount == 1){
-        // No meaningful operation here, degenerate to outputting the same data each time.
-
-        memcpy(recoveryBlock, originals[0].Block, params.BlockBytes);
-        return;
-    }
-    // else OriginalCount >= 2:
+// Matrix parameters for a recovery row (0-based) or original column, taken
+// from params.Matrix if one was provided and the default form above if not.
+static FORCE_INLINE uint8_t MatrixX(cauchy_encoder_params params, int recoveryIndex){
+    return params.Matrix ? params.Matrix->X[recoveryIndex] : (uint8_t)(params.OriginalCount + recoveryIndex);
+}
+static FORCE_INLINE uint8_t MatrixY(cauchy_encoder_params params, int originalIndex){
+    return params.Matrix ? params.Matrix->Y[originalIndex] : (uint8_t)(originalIndex);
+}
+static FORCE_INLINE uint8_t MatrixRowScale(cauchy_encoder_params params, int recoveryIndex){
+    return params.Matrix ? params.Matrix->RowScale[recoveryIndex] : 1;
+}
+static FORCE_INLINE uint8_t MatrixColScale(cauchy_encoder_params params, int originalIndex){
+    // Default matrix scales column j by (x_0 + y_j) so that its first row is all ones
+    return params.Matrix ? params.Matrix->ColScale[originalIndex]
+        : gf_add((uint8_t)(params.OriginalCount), (uint8_t)(originalIndex));
+}
 
-    // Unroll first row of recovery matrix:
-    // The matrix we generate for the first row is all ones,
-    // so it is merely a parity of the original data.
-    if (recoveryBlockIndex == params.OriginalCount){
-        gf_addset_mem(recoveryBlock, originals[0].Block, originals[1].Block, params.BlockBytes);
-        for (j = 2; j < params.OriginalCount; ++j){
-            gf_add_mem(recoveryBlock, originals[j].Block, params.BlockBytes);
-        }
-        return;
+// Matrix element for a recovery row (0-based) and original column as used by
+// the encoder.  The first row is all ones and a single original is copied.
+static FORCE_INLINE uint8_t GetEncodeElement(cauchy_encoder_params params, int recoveryIndex, int originalIndex){
+    if (params.OriginalCount == 1 || recoveryIndex == 0){
+        return 1;
     }
-
-    // TBD: Faster algorithms seem to exist for computing this matrix-vector product.
-
-    // Start the x_0 values arbitrarily from the original count.
-    x_0 = (uint8_t)(params.OriginalCount);
-
-    // For other rows:
-    {
-        x_i = (uint8_t)(recoveryBlockIndex);
-
-        // Unroll first operation for speed
-        {
-            y_0 = 0;
-            matrixElement = GetMatrixElement(x_i, x_0, y_0);
-
-            gf_mul_mem(recoveryBlock, originals[0].Block, matrixElement, params.BlockBytes);
-        }
-
-        // For each original data column,
-        for (j = 1; j < params.OriginalCount; ++j){
-            y_j = (uint8_t)(j);
-            matrixElement = GetMatrixElement(x_i, x_0, y_j);
-
-            gf_muladd_mem(recoveryBlock, matrixElement, originals[j].Block, params.BlockBytes);
-        }
+    if (!params.Matrix){
+        return GetMatrixElement((uint8_t)(params.OriginalCount + recoveryIndex),
+            (uint8_t)(params.OriginalCount), (uint8_t)(originalIndex));
     }
+    // a_ij = r_i * c_j / (x_i + y_j)
+    return gf_div(gf_mul(params.Matrix->RowScale[recoveryIndex], params.Matrix->ColScale[originalIndex]),
+        gf_add(params.Matrix->X[recoveryIndex], params.Matrix->Y[originalIndex]));
 }
 
-int cauchy_rs_encode(
-    cauchy_encoder_params params, // Encoder params
-    uint8_t** dataBlocks,
-    uint8_t** parityBlocks)        // Output recovery blocks end-to-end
-{
-    cauchy_block* originals = cauchy_malloc(sizeof(cauchy_block) * params.OriginalCount);
-    int block;
+// Nonzero if params select a code other than Cauchy, which only
+// cauchy_rs_encode/decode() handle, or params.Matrix was built for different
+// counts.  Code is tested first, so a Matrix left unset next to an unknown
+// Code is never followed.
+static FORCE_INLINE int CheckMatrix(cauchy_encoder_params params){
+    return params.Code != CAUCHY_CODE_CAUCHY ||
+        (params.Matrix && (params.Matrix->OriginalCount != params.OriginalCount ||
+        params.Matrix->RecoveryCount != params.RecoveryCount));
+}
 
+// Checks shared by the entry points: 0, -2 if there are more than 256
+// blocks, or -1 for any other bad count or matrix
+static int CheckParams(cauchy_encoder_params params){
     if (params.OriginalCount <= 0 || params.RecoveryCount <= 0 || params.BlockBytes <= 0){
         return -1;
     }
     if (params.OriginalCount + params.RecoveryCount > 256){
         return -2;
     }
-    if (!originals || !parityBlocks || !dataBlocks){
-        return -3;
-    }
-
-    for (block = 0; block < params.OriginalCount; ++block){
-        originals[block].Block = dataBlocks[block];
-    }
-
-    for (block = 0; block < params.RecoveryCount; ++block){
-        //print_hex_dump(KERN_DEBUG, "data: ", DUMP_PREFIX_OFFSET, 20, 1, (void*)originals[block].Block, 16, true);
-        cauchy_rs_encode_block(params, originals, (params.OriginalCount + block), parityBlocks[block]);
-	//print_hex_dump(KERN_DEBUG, "parity: ", DUMP_PREFIX_OFFSET, 20, 1, (void*)parityBlocks[block], 16, true);
+    if (CheckMatrix(params)){
+        return -1;
     }
-
-    kfree(originals);
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Specialized Encoders
+
+/*
+    Each geometry in CAUCHY_FIXED_GEOMETRIES gets its own encoder in which the
+    block counts are constants, so the loops over originals and recovery rows
+    unroll completely.  Every 32 bytes of the originals are loaded once and
+    the product for each recovery row is accumulated in a register, rather
+    than making one pass over the originals per recovery row.
+
+    The coefficients depend only on the geometry but the multiply tables
+    depend on the field, so the tables for each geometry are filled in by
+    cauchy_init() and then read-only.
+*/
+
+#if defined(GF_AVX2)
+
+// Bounds on specialized geometries, which keep the accumulators in registers
+#define CAUCHY_FIXED_MAX_ORIGINAL 32
+#define CAUCHY_FIXED_MAX_RECOVERY 8
+
+static FORCE_INLINE void EncodeFixed(
+    const int k,                  // Original count, a constant
+    const int m,                  // Recovery count, a constant
+    const M256* tableLo,          // Low nibble tables, (m - 1) x k
+    const M256* tableHi,          // High nibble tables, (m - 1) x k
+    const uint8_t* matrix,        // Matrix rows after the first, (m - 1) x k
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks,       // Array of pointers to output parity blocks
+    int bytes)                    // Bytes in each block
+{
+    const int vectorBytes = bytes & ~31;
+    const uint8_t* in[CAUCHY_FIXED_MAX_ORIGINAL];
+    uint8_t* out[CAUCHY_FIXED_MAX_RECOVERY];
+    M256 acc[CAUCHY_FIXED_MAX_RECOVERY], clr_mask, x0, l0, h0, p0;
+    uint8_t sum[CAUCHY_FIXED_MAX_RECOVERY], d;
+    int offset, end, i, j, r;
+
+    for (j = 0; j < k; ++j) {
+        in[j] = dataBlocks[j];
+    }
+    for (r = 0; r < m; ++r) {
+        out[r] = parityBlocks[r];
+    }
+
+    clr_mask = vector_set_256(0x0f);
+
+    // Give up the FPU between tiles
+    for (offset = 0; offset < vectorBytes; offset = end) {
+        end = offset + CAUCHY_MIN_TILE_BYTES;
+        if (end > vectorBytes) {
+            end = vectorBytes;
+        }
+
+        kernel_fpu_begin();
+        for (i = offset; i < end; i += 32) {
+#pragma GCC unroll 32
+            for (j = 0; j < k; ++j) {
+                x0 = *(const M256*)(in[j] + i);
+                l0 = vector_and_256(x0, clr_mask);
+                h0 = vector_and_256(vector_srli_epi64_256(x0, 4), clr_mask);
+
+                // First row is all ones
+                acc[0] = j ? vector_xor_256(acc[0], x0) : x0;
+
+#pragma GCC unroll 8
+                for (r = 1; r < m; ++r) {
+                    p0 = vector_xor_256(
+                        vector_shuffle_epi8_256(tableLo[(r - 1) * k + j], l0),
+                        vector_shuffle_epi8_256(tableHi[(r - 1) * k + j], h0));
+                    acc[r] = j ? vector_xor_256(acc[r], p0) : p0;
+                }
+            }
+
+#pragma GCC unroll 8
+            for (r = 0; r < m; ++r) {
+                *(M256*)(out[r] + i) = acc[r];
+            }
+        }
+        kernel_fpu_end();
+    }
+
+    // Remaining bytes one at a time
+    for (i = vectorBytes; i < bytes; ++i) {
+        for (r = 0; r < m; ++r) {
+            sum[r] = 0;
+        }
+        for (j = 0; j < k; ++j) {
+            d = in[j][i];
+            sum[0] ^= d;
+            for (r = 1; r < m; ++r) {
+                sum[r] ^= gf_mul(matrix[(r - 1) * k + j], d);
+            }
+        }
+        for (r = 0; r < m; ++r) {
+            out[r][i] = sum[r];
+        }
+    }
+}
+
+// Tables and encoder for one geometry
+#define CAUCHY_FIXED_ENCODER(K, M)                                                  \
+    typedef char FixedCheck_##K##_##M[((K) >= 2 && (K) <= CAUCHY_FIXED_MAX_ORIGINAL \
+        && (M) >= 2 && (M) <= CAUCHY_FIXED_MAX_RECOVERY) ? 1 : -1];                 \
+    static M256 FixedLo_##K##_##M[((M) - 1) * (K)];                                 \
+    static M256 FixedHi_##K##_##M[((M) - 1) * (K)];                                 \
+    static uint8_t FixedMatrix_##K##_##M[((M) - 1) * (K)];                          \
+    static void EncodeFixed_##K##_##M(uint8_t** dataBlocks, uint8_t** parityBlocks, int bytes) \
+    {                                                                               \
+        EncodeFixed(K, M, FixedLo_##K##_##M, FixedHi_##K##_##M, FixedMatrix_##K##_##M, \
+            dataBlocks, parityBlocks, bytes);                                       \
+    }
+CAUCHY_FIXED_GEOMETRIES(CAUCHY_FIXED_ENCODER)
+#undef CAUCHY_FIXED_ENCODER
+
+static void FixedTablesInit(int k, int m, M256* tableLo, M256* tableHi, uint8_t* matrix)
+{
+    cauchy_encoder_params params = { 0 };
+    gf_mul_table mul;
+    int r, j;
+
+    params.OriginalCount = k;
+    params.RecoveryCount = m;
+
+    for (r = 1; r < m; ++r) {
+        for (j = 0; j < k; ++j) {
+            matrix[(r - 1) * k + j] = GetEncodeElement(params, r, j);
+            gf_mul_table_init(&mul, matrix[(r - 1) * k + j]);
+            tableLo[(r - 1) * k + j] = *mul.Lo256;
+            tableHi[(r - 1) * k + j] = *mul.Hi256;
+        }
+    }
+}
+
+static void FixedEncoderInit(void)
+{
+#define CAUCHY_FIXED_INIT(K, M) \
+    FixedTablesInit(K, M, FixedLo_##K##_##M, FixedHi_##K##_##M, FixedMatrix_##K##_##M);
+CAUCHY_FIXED_GEOMETRIES(CAUCHY_FIXED_INIT)
+#undef CAUCHY_FIXED_INIT
+}
+
+// Returns nonzero if a specialized encoder handled the parameters
+static int EncodeFixedGeometry(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks)       // Array of pointers to output parity blocks
+{
+    // Only the default matrix is specialized
+    if (params.Matrix || !CpuHasAVX2) {
+        return 0;
+    }
+
+#define CAUCHY_FIXED_DISPATCH(K, M)                                          \
+    if (params.OriginalCount == (K) && params.RecoveryCount == (M)) {       \
+        EncodeFixed_##K##_##M(dataBlocks, parityBlocks, params.BlockBytes); \
+        return 1;                                                           \
+    }
+CAUCHY_FIXED_GEOMETRIES(CAUCHY_FIXED_DISPATCH)
+#undef CAUCHY_FIXED_DISPATCH
+
+    return 0;
+}
+
+#else // GF_AVX2
+
+static void FixedEncoderInit(void)
+{
+}
+
+static int EncodeFixedGeometry(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks)       // Array of pointers to output parity blocks
+{
+    return 0;
+}
+
+#endif // GF_AVX2
+
+
+//-----------------------------------------------------------------------------
+// RAID-6
+
+/*
+    P+Q as computed by the Linux md raid6 library.  P is the XOR of the
+    originals and Q = sum(g^i * D_i) with g = 2 in GF(256) under the 0x11d
+    polynomial, which is not the field the rest of this library uses.
+
+    Q is evaluated by Horner's rule from the last original down, so the
+    encoder only ever multiplies by 2, which is a shift and a conditional
+    XOR on each byte and needs no tables.  The two erasure decoder multiplies
+    by two constants, using nibble tables built for the 0x11d field.
+*/
+
+#define RAID6_POLYNOMIAL 0x11d
+
+typedef uint8_t Raid6V32 __attribute__ ((__vector_size__ (32)));
+typedef uint8_t Raid6V16 __attribute__ ((__vector_size__ (16)));
+
+// Multiply tables for one constant in the RAID-6 field
+typedef struct Raid6MulTable_t {
+#if defined(GF_AVX2)
+    M256 Lo256, Hi256;
+#endif
+    M128 Lo128, Hi128;
+    uint8_t Scalar[256];
+    gf_mul_table Mul;
+} Raid6MulTable;
+
+static uint8_t Raid6Mul(uint8_t x, uint8_t y)
+{
+    unsigned product = 0, a = x;
+
+    for (; y; y >>= 1) {
+        if (y & 1) {
+            product ^= a;
+        }
+        a <<= 1;
+        if (a & 0x100) {
+            a ^= RAID6_POLYNOMIAL;
+        }
+    }
+    return (uint8_t)(product);
+}
+
+// g^n
+static uint8_t Raid6Exp(int n)
+{
+    uint8_t x = 1;
+
+    while (n-- > 0) {
+        x = Raid6Mul(x, 2);
+    }
+    return x;
+}
+
+// x^254 = 1/x
+static uint8_t Raid6Inv(uint8_t x)
+{
+    uint8_t inverse = 1;
+    int i;
+
+    for (i = 0; i < 254; ++i) {
+        inverse = Raid6Mul(inverse, x);
+    }
+    return inverse;
+}
+
+static void Raid6MulTableInit(Raid6MulTable* table, uint8_t y)
+{
+    int x;
+
+    for (x = 0; x < 256; ++x) {
+        table->Scalar[x] = Raid6Mul((uint8_t)(x), y);
+    }
+    for (x = 0; x < 16; ++x) {
+        ((uint8_t*)&table->Lo128)[x] = table->Scalar[x];
+        ((uint8_t*)&table->Hi128)[x] = table->Scalar[x << 4];
+    }
+#if defined(GF_AVX2)
+    memcpy(&table->Lo256, &table->Lo128, 16);
+    memcpy((uint8_t*)&table->Lo256 + 16, &table->Lo128, 16);
+    memcpy(&table->Hi256, &table->Hi128, 16);
+    memcpy((uint8_t*)&table->Hi256 + 16, &table->Hi128, 16);
+    table->Mul.Lo256 = &table->Lo256;
+    table->Mul.Hi256 = &table->Hi256;
+#endif
+    table->Mul.Lo128 = &table->Lo128;
+    table->Mul.Hi128 = &table->Hi128;
+    table->Mul.Scalar = table->Scalar;
+    table->Mul.Y = y;
+}
+
+// Shift each byte left and reduce by 0x1d where its top bit was set
+static FORCE_INLINE Raid6V32 Raid6Mul2_256(Raid6V32 x)
+{
+    return (x + x) ^ (-(x >> 7) & 0x1d);
+}
+
+static FORCE_INLINE Raid6V16 Raid6Mul2_128(Raid6V16 x)
+{
+    return (x + x) ^ (-(x >> 7) & 0x1d);
+}
+
+// P and Q of the originals, where originals skipX and skipY are taken as
+// zero, plus pIn and qIn if given.  P and Q stay in registers across all
+// originals.
+static void Raid6Syndrome(
+    int originalCount,            // Number of originals
+    uint8_t** dataBlocks,         // Originals
+    int skipX,                    // Original taken as zero, or -1
+    int skipY,                    // Original taken as zero, or -1
+    const uint8_t* pIn,           // Added to P, or NULL
+    const uint8_t* qIn,           // Added to Q, or NULL
+    uint8_t* p,                   // Output P
+    uint8_t* q,                   // Output Q
+    int bytes)                    // Bytes in each block
+{
+    int offset = 0, end, i;
+    uint8_t wp, wq, d;
+
+#if defined(GF_AVX2)
+    if (CpuHasAVX2) {
+        const int vectorBytes = bytes & ~63;
+        Raid6V32 wp0, wq0, wd0, wp1, wq1, wd1;
+
+        while (offset < vectorBytes) {
+            end = offset + CAUCHY_MIN_TILE_BYTES;
+            if (end > vectorBytes) {
+                end = vectorBytes;
+            }
+
+            kernel_fpu_begin();
+            for (; offset < end; offset += 64) {
+                wp0 = wq0 = wp1 = wq1 = (Raid6V32){ 0 };
+                for (i = originalCount - 1; i >= 0; --i) {
+                    wq0 = Raid6Mul2_256(wq0);
+                    wq1 = Raid6Mul2_256(wq1);
+                    if (i != skipX && i != skipY) {
+                        wd0 = *(const Raid6V32*)(dataBlocks[i] + offset);
+                        wd1 = *(const Raid6V32*)(dataBlocks[i] + offset + 32);
+                        wp0 ^= wd0;
+                        wq0 ^= wd0;
+                        wp1 ^= wd1;
+                        wq1 ^= wd1;
+                    }
+                }
+                if (pIn) {
+                    wp0 ^= *(const Raid6V32*)(pIn + offset);
+                    wp1 ^= *(const Raid6V32*)(pIn + offset + 32);
+                }
+                if (qIn) {
+                    wq0 ^= *(const Raid6V32*)(qIn + offset);
+                    wq1 ^= *(const Raid6V32*)(qIn + offset + 32);
+                }
+                *(Raid6V32*)(p + offset) = wp0;
+                *(Raid6V32*)(p + offset + 32) = wp1;
+                *(Raid6V32*)(q + offset) = wq0;
+                *(Raid6V32*)(q + offset + 32) = wq1;
+            }
+            kernel_fpu_end();
+        }
+    }
+#endif // GF_AVX2
+
+    {
+        const int vectorBytes = bytes & ~15;
+        Raid6V16 wp0, wq0, wd0;
+
+        while (offset < vectorBytes) {
+            end = offset + CAUCHY_MIN_TILE_BYTES;
+            if (end > vectorBytes) {
+                end = vectorBytes;
+            }
+
+            kernel_fpu_begin();
+            for (; offset < end; offset += 16) {
+                wp0 = wq0 = (Raid6V16){ 0 };
+                for (i = originalCount - 1; i >= 0; --i) {
+                    wq0 = Raid6Mul2_128(wq0);
+                    if (i != skipX && i != skipY) {
+                        wd0 = *(const Raid6V16*)(dataBlocks[i] + offset);
+                        wp0 ^= wd0;
+                        wq0 ^= wd0;
+                    }
+                }
+                if (pIn) {
+                    wp0 ^= *(const Raid6V16*)(pIn + offset);
+                }
+                if (qIn) {
+                    wq0 ^= *(const Raid6V16*)(qIn + offset);
+                }
+                *(Raid6V16*)(p + offset) = wp0;
+                *(Raid6V16*)(q + offset) = wq0;
+            }
+            kernel_fpu_end();
+        }
+    }
+
+    for (; offset < bytes; ++offset) {
+        wp = pIn ? pIn[offset] : 0;
+        wq = 0;
+        for (i = originalCount - 1; i >= 0; --i) {
+            wq = (uint8_t)((wq << 1) ^ ((wq & 0x80) ? 0x1d : 0));
+            if (i != skipX && i != skipY) {
+                d = dataBlocks[i][offset];
+                wp ^= d;
+                wq ^= d;
+            }
+        }
+        p[offset] = wp;
+        q[offset] = qIn ? (uint8_t)(wq ^ qIn[offset]) : wq;
+    }
+}
+
+static int Raid6CheckParams(cauchy_encoder_params params)
+{
+    if (params.OriginalCount <= 0 || params.RecoveryCount <= 0 || params.BlockBytes <= 0) {
+        return -1;
+    }
+    if (params.OriginalCount + params.RecoveryCount > 256) {
+        return -2;
+    }
+    if (params.RecoveryCount > 2 || params.Matrix) {
+        return -1;
+    }
+    return 0;
+}
+
+static int Raid6Encode(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks)       // Output P, then Q
+{
+    int ret = Raid6CheckParams(params), j;
+
+    if (ret) {
+        return ret;
+    }
+    if (!dataBlocks || !parityBlocks) {
+        return -3;
+    }
+
+    if (params.RecoveryCount == 2) {
+        Raid6Syndrome(params.OriginalCount, dataBlocks, -1, -1, NULL, NULL,
+            parityBlocks[0], parityBlocks[1], params.BlockBytes);
+        return 0;
+    }
+
+    // P alone
+    if (params.OriginalCount == 1) {
+        memcpy(parityBlocks[0], dataBlocks[0], params.BlockBytes);
+        return 0;
+    }
+    gf_addset_mem(parityBlocks[0], dataBlocks[0], dataBlocks[1], params.BlockBytes);
+    for (j = 2; j < params.OriginalCount; ++j) {
+        gf_add_mem(parityBlocks[0], dataBlocks[j], params.BlockBytes);
+    }
+    return 0;
+}
+
+/*
+    One erasure is recovered from P.  For two, x < y, the syndrome of the
+    surviving originals gives Pxy = D_x + D_y and Qxy = g^x D_x + g^y D_y,
+    so D_x = (g^y Pxy + Qxy) / (g^x + g^y) and D_y = Pxy + D_x.  Everything
+    is computed in the two erased blocks, the parity is left untouched.
+*/
+static int Raid6Decode(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks,       // P, then Q
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures)         // the number of erasures
+{
+    Raid6MulTable tableA, tableB;
+    uint8_t inverse;
+    int ret = Raid6CheckParams(params), x, y, j;
+
+    if (ret) {
+        return ret;
+    }
+    if (num_erasures > params.RecoveryCount) {
+        return -1;
+    }
+    for (j = 0; j < num_erasures; j++) {
+        if (erasures[j] >= params.OriginalCount) {
+            return -1;
+        }
+    }
+    if (num_erasures == 0) {
+        return 0;
+    }
+    if (!dataBlocks || !parityBlocks) {
+        return -3;
+    }
+
+    if (num_erasures == 1) {
+        x = erasures[0];
+        memcpy(dataBlocks[x], parityBlocks[0], params.BlockBytes);
+        for (j = 0; j < params.OriginalCount; ++j) {
+            if (j != x) {
+                gf_add_mem(dataBlocks[x], dataBlocks[j], params.BlockBytes);
+            }
+        }
+        return 0;
+    }
+
+    x = erasures[0] < erasures[1] ? erasures[0] : erasures[1];
+    y = erasures[0] < erasures[1] ? erasures[1] : erasures[0];
+    if (x == y) {
+        return -1;
+    }
+
+    // Qxy into D_x and Pxy into D_y
+    Raid6Syndrome(params.OriginalCount, dataBlocks, x, y, parityBlocks[0], parityBlocks[1],
+        dataBlocks[y], dataBlocks[x], params.BlockBytes);
+
+    inverse = Raid6Inv(Raid6Exp(x) ^ Raid6Exp(y));
+    Raid6MulTableInit(&tableA, Raid6Mul(Raid6Exp(y), inverse));
+    Raid6MulTableInit(&tableB, inverse);
+
+    gf_mul_mem_table_inplace(dataBlocks[x], &tableB.Mul, params.BlockBytes);
+    gf_muladd_mem_table(dataBlocks[x], &tableA.Mul, dataBlocks[y], params.BlockBytes);
+    gf_add_mem(dataBlocks[y], dataBlocks[x], params.BlockBytes);
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Matrix search
+
+// Number of candidate matrices tried by cauchy_matrix_create()
+#define CAUCHY_MATRIX_TRIALS 256
+
+// Set bits in the 8x8 bit matrix of multiplication by y, which is the number
+// of XORs a bitsliced multiply costs and tracks the table multiply cost too
+static int MatrixBitCost(uint8_t y){
+    int bits = 0, b;
+    uint8_t v;
+
+    for (b = 0; b < 8; ++b){
+        for (v = gf_mul(y, (uint8_t)(1 << b)); v; v &= v - 1){
+            ++bits;
+        }
+    }
+    return bits;
+}
+
+// Chooses the row scaling of recovery row i that makes the most elements one,
+// then the fewest bit matrix bits.  Adds the cost of the row to the totals.
+static void ScaleMatrixRow(cauchy_matrix* matrix, int i, const uint8_t* bitCost, int* nonOnes, int* bits){
+    uint8_t element[256];
+    int bestOnes = -1, bestBits = 0, ones, rowBits, j, r;
+
+    for (j = 0; j < matrix->OriginalCount; ++j){
+        element[j] = gf_div(matrix->ColScale[j], gf_add(matrix->X[i], matrix->Y[j]));
+    }
+
+    for (r = 1; r < 256; ++r){
+        ones = 0;
+        rowBits = 0;
+        for (j = 0; j < matrix->OriginalCount; ++j){
+            uint8_t a_ij = gf_mul((uint8_t)(r), element[j]);
+            if (a_ij == 1){
+                ++ones;
+            }
+            rowBits += bitCost[a_ij];
+        }
+        if (ones > bestOnes || (ones == bestOnes && rowBits < bestBits)){
+            bestOnes = ones;
+            bestBits = rowBits;
+            matrix->RowScale[i] = (uint8_t)(r);
+        }
+    }
+
+    *nonOnes += matrix->OriginalCount - bestOnes;
+    *bits += bestBits;
+}
+
+cauchy_matrix* cauchy_matrix_create(int originalCount, int recoveryCount)
+{
+    cauchy_matrix *best, *trial;
+    uint8_t bitCost[256], values[256], t;
+    uint32_t seed;
+    int bestNonOnes = 0, bestBits = 0, nonOnes, bits, trialIndex, i, j;
+
+    if (originalCount <= 0 || recoveryCount <= 0 || originalCount + recoveryCount > 256){
+        return NULL;
+    }
+
+    best = cauchy_malloc(sizeof(cauchy_matrix) * 2);
+    if (!best){
+        return NULL;
+    }
+    trial = best + 1;
+
+    for (i = 0; i < 256; ++i){
+        bitCost[i] = (uint8_t)(MatrixBitCost((uint8_t)(i)));
+        values[i] = (uint8_t)(i);
+    }
+
+    // Fixed seed so the same counts always yield the same matrix
+    seed = 0x9E3779B9u ^ (uint32_t)(originalCount << 8 | recoveryCount);
+
+    for (trialIndex = 0; trialIndex < CAUCHY_MATRIX_TRIALS; ++trialIndex){
+        trial->OriginalCount = originalCount;
+        trial->RecoveryCount = recoveryCount;
+
+        if (trialIndex == 0){
+            // Start from the default x_i = k + i, y_j = j
+            for (i = 0; i < recoveryCount; ++i){
+                trial->X[i] = (uint8_t)(originalCount + i);
+            }
+            for (j = 0; j < originalCount; ++j){
+                trial->Y[j] = (uint8_t)(j);
+            }
+        } else {
+            // Otherwise draw distinct x and y values by a partial shuffle
+            for (i = 0; i < originalCount + recoveryCount; ++i){
+                seed = seed * 1664525u + 1013904223u;
+                j = i + (int)((seed >> 16) % (uint32_t)(256 - i));
+                t = values[i];
+                values[i] = values[j];
+                values[j] = t;
+            }
+            memcpy(trial->X, values, recoveryCount);
+            memcpy(trial->Y, values + recoveryCount, originalCount);
+        }
+
+        // Column scaling makes the first row all ones
+        for (j = 0; j < originalCount; ++j){
+            trial->ColScale[j] = gf_add(trial->X[0], trial->Y[j]);
+        }
+        trial->RowScale[0] = 1;
+
+        nonOnes = 0;
+        bits = 0;
+        for (i = 1; i < recoveryCount; ++i){
+            ScaleMatrixRow(trial, i, bitCost, &nonOnes, &bits);
+        }
+
+        if (trialIndex == 0 || nonOnes < bestNonOnes || (nonOnes == bestNonOnes && bits < bestBits)){
+            bestNonOnes = nonOnes;
+            bestBits = bits;
+            memcpy(best, trial, sizeof(cauchy_matrix));
+        }
+
+        // With a single recovery row, or a single column, nothing can beat the first
+        if (recoveryCount == 1 || originalCount == 1){
+            break;
+        }
+    }
+
+    return best;
+}
+
+void cauchy_matrix_free(cauchy_matrix* matrix)
+{
+    kfree(matrix);
+}
+
+
+//-----------------------------------------------------------------------------
+// Encoding
+
+// Number of valid bytes in an original block, the rest is implicitly zero
+static FORCE_INLINE int BlockLength(cauchy_encoder_params params, const int* blockLengths, int originalIndex){
+    return blockLengths ? blockLengths[originalIndex] : params.BlockBytes;
+}
+
+// Performs "z[] = x[] * y" over the first xBytes and zero-fills z[] up to bytes
+static void gf_mul_mem_padded(void * __restrict vz, const void * __restrict vx, uint8_t y, int xBytes, int bytes){
+    gf_mul_mem(vz, vx, y, xBytes);
+    if (xBytes < bytes){
+        memset((uint8_t*)vz + xBytes, 0, bytes - xBytes);
+    }
+}
+
+// Encode one recovery block from originals of varying length.
+// Each original only contributes its first blockLengths[j] bytes.
+static void EncodeBlockVarlen(
+    cauchy_encoder_params params, // Encoder parameters
+    cauchy_block* originals,      // Array of pointers to original blocks
+    const int* blockLengths,      // Valid bytes in each original block
+    int recoveryBlockIndex,       // Return value from cauchy_get_recovery_block_index()
+    void* recoveryBlock)          // Output recovery block
+{
+    const int recoveryIndex = recoveryBlockIndex - params.OriginalCount;
+    uint8_t matrixElement;
+    int j;
+
+    // The first row is all ones, so GetEncodeElement() returns 1 there and
+    // gf_muladd_mem() falls back to XOR.
+    matrixElement = GetEncodeElement(params, recoveryIndex, 0);
+    gf_mul_mem_padded(recoveryBlock, originals[0].Block, matrixElement, blockLengths[0], params.BlockBytes);
+
+    for (j = 1; j < params.OriginalCount; ++j){
+        matrixElement = GetEncodeElement(params, recoveryIndex, j);
+        gf_muladd_mem(recoveryBlock, matrixElement, originals[j].Block, blockLengths[j]);
+    }
+}
+
+void cauchy_rs_encode_block(
+    cauchy_encoder_params params, // Encoder parameters
+    cauchy_block* originals,      // Array of pointers to original blocks
+    int recoveryBlockIndex,      // Return value from cauchy_get_recovery_block_index()
+    void* recoveryBlock)         // Output recovery block
+{   
+    uint8_t matrixElement;
+    int recoveryIndex, j;
+    // If only one block of input data,
+    if (params.OriginalCount == 1){
+        // No meaningful operation here, degenerate to outputting the same data each time.
+
+        memcpy(recoveryBlock, originals[0].Block, params.BlockBytes);
+        return;
+    }
+    // else OriginalCount >= 2:
+
+    // Unroll first row of recovery matrix:
+    // The matrix we generate for the first row is all ones,
+    // so it is merely a parity of the original data.
+    if (recoveryBlockIndex == params.OriginalCount){
+        gf_addset_mem(recoveryBlock, originals[0].Block, originals[1].Block, params.BlockBytes);
+        for (j = 2; j < params.OriginalCount; ++j){
+            gf_add_mem(recoveryBlock, originals[j].Block, params.BlockBytes);
+        }
+        return;
+    }
+
+    // TBD: Faster algorithms seem to exist for computing this matrix-vector product.
+
+    // For other rows:
+    {
+        recoveryIndex = recoveryBlockIndex - params.OriginalCount;
+
+        // Unroll first operation for speed
+        {
+            matrixElement = GetEncodeElement(params, recoveryIndex, 0);
+
+            gf_mul_mem(recoveryBlock, originals[0].Block, matrixElement, params.BlockBytes);
+        }
+
+        // For each original data column,
+        for (j = 1; j < params.OriginalCount; ++j){
+            matrixElement = GetEncodeElement(params, recoveryIndex, j);
+
+            gf_muladd_mem(recoveryBlock, matrixElement, originals[j].Block, params.BlockBytes);
+        }
+    }
+}
+
+int cauchy_rs_encode(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks)        // Output recovery blocks end-to-end
+{
+    cauchy_block* originals;
+    int block, ret;
+
+    if (params.Code == CAUCHY_CODE_RAID6){
+        return Raid6Encode(params, dataBlocks, parityBlocks);
+    }
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (!parityBlocks || !dataBlocks){
+        return -3;
+    }
+
+    // Geometries with a specialized encoder
+    if (EncodeFixedGeometry(params, dataBlocks, parityBlocks)){
+        return 0;
+    }
+
+    originals = cauchy_malloc(sizeof(cauchy_block) * params.OriginalCount);
+    if (!originals){
+        return -3;
+    }
+
+    for (block = 0; block < params.OriginalCount; ++block){
+        originals[block].Block = dataBlocks[block];
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        //print_hex_dump(KERN_DEBUG, "data: ", DUMP_PREFIX_OFFSET, 20, 1, (void*)originals[block].Block, 16, true);
+        cauchy_rs_encode_block(params, originals, (params.OriginalCount + block), parityBlocks[block]);
+	//print_hex_dump(KERN_DEBUG, "parity: ", DUMP_PREFIX_OFFSET, 20, 1, (void*)parityBlocks[block], 16, true);
+    }
+
+    kfree(originals);
+    return 0;
+}
+
+// Encode one recovery block from originals laid out dataStride bytes apart.
+// This mirrors cauchy_rs_encode_block() without needing a cauchy_block array.
+static void EncodeBlockStrided(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* data,          // First original block
+    int dataStride,               // Bytes between the starts of original blocks
+    int bytes,                    // Bytes to encode in each block
+    int recoveryBlockIndex,       // Return value from cauchy_get_recovery_block_index()
+    uint8_t* recoveryBlock)       // Output recovery block
+{
+    const int recoveryIndex = recoveryBlockIndex - params.OriginalCount;
+    uint8_t matrixElement;
+    int j;
+
+    if (params.OriginalCount == 1){
+        memcpy(recoveryBlock, data, bytes);
+        return;
+    }
+
+    if (recoveryIndex == 0){
+        gf_addset_mem(recoveryBlock, data, data + dataStride, bytes);
+        for (j = 2; j < params.OriginalCount; ++j){
+            gf_add_mem(recoveryBlock, data + (long)j * dataStride, bytes);
+        }
+        return;
+    }
+
+    matrixElement = GetEncodeElement(params, recoveryIndex, 0);
+    gf_mul_mem(recoveryBlock, data, matrixElement, bytes);
+
+    for (j = 1; j < params.OriginalCount; ++j){
+        matrixElement = GetEncodeElement(params, recoveryIndex, j);
+        gf_muladd_mem(recoveryBlock, matrixElement, data + (long)j * dataStride, bytes);
+    }
+}
+
+int cauchy_rs_encode_packets(
+    cauchy_encoder_params params, // Encoder params, BlockBytes is the packet size
+    int stripeCount,              // Number of independent stripes
+    const uint8_t* data,          // OriginalCount columns of stripeCount packets
+    uint8_t* parity)              // RecoveryCount columns of stripeCount packets
+{
+    int block, columnBytes, ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (stripeCount <= 0){
+        return -1;
+    }
+    if (!data || !parity){
+        return -3;
+    }
+    if (params.BlockBytes > (0x7fffffff - GF_ALIGN_BYTES) / stripeCount){
+        return -1;
+    }
+
+    // Packet i of every stripe is contiguous, so each matrix element is
+    // applied to all stripes in a single full-width pass.
+    columnBytes = cauchy_get_packet_column_bytes(params, stripeCount);
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        EncodeBlockStrided(params, data, columnBytes, params.BlockBytes * stripeCount,
+            (params.OriginalCount + block), parity + (long)block * columnBytes);
+    }
+
+    return 0;
+}
+
+int cauchy_rs_encode_strided(
+    cauchy_encoder_params params, // Encoder params
+    const uint8_t* data,          // First original block
+    int dataStride,               // Bytes between original blocks
+    uint8_t* parity,              // First parity block
+    int parityStride)             // Bytes between parity blocks
+{
+    int block, ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (!data || !parity){
+        return -3;
+    }
+    if (dataStride < params.BlockBytes || parityStride < params.BlockBytes){
+        return -1;
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        EncodeBlockStrided(params, data, dataStride, params.BlockBytes,
+            (params.OriginalCount + block), parity + (long)block * parityStride);
+    }
+
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Cache Tiling
+
+int cauchy_get_tile_bytes(cauchy_encoder_params params)
+{
+    int blocks = params.OriginalCount + params.RecoveryCount;
+    int tileBytes;
+
+    if (blocks <= 0) {
+        return CAUCHY_MIN_TILE_BYTES;
+    }
+
+    // Keep one tile of every original and recovery block within half of L2,
+    // leaving the rest for tables and whatever else the caller has resident.
+    tileBytes = (int)(CpuL2CacheBytes / 2 / blocks) & ~(CAUCHY_MIN_TILE_BYTES - 1);
+    if (tileBytes < CAUCHY_MIN_TILE_BYTES) {
+        tileBytes = CAUCHY_MIN_TILE_BYTES;
+    }
+    return tileBytes;
+}
+
+// Round a caller-provided tile size to something the kernels handle without
+// changing alignment between tiles, or pick one if it is not positive.
+static int GetTileBytes(cauchy_encoder_params params, int tileBytes)
+{
+    if (tileBytes <= 0) {
+        return cauchy_get_tile_bytes(params);
+    }
+    return (tileBytes + GF_ALIGN_BYTES - 1) & ~(GF_ALIGN_BYTES - 1);
+}
+
+// Encode bytes [offset, offset + bytes) of one recovery block
+static void EncodeBlockRange(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    int offset,                   // First byte of the range
+    int bytes,                    // Bytes in the range
+    int recoveryIndex,            // Recovery row, starting from 0
+    uint8_t* recoveryBlock)       // Output recovery block
+{
+    int j = 1;
+
+    if (params.OriginalCount >= 2 && recoveryIndex == 0){
+        gf_addset_mem(recoveryBlock + offset, dataBlocks[0] + offset, dataBlocks[1] + offset, bytes);
+        j = 2;
+    } else {
+        gf_mul_mem(recoveryBlock + offset, dataBlocks[0] + offset,
+            GetEncodeElement(params, recoveryIndex, 0), bytes);
+    }
+
+    for (; j < params.OriginalCount; ++j){
+        gf_muladd_mem(recoveryBlock + offset, GetEncodeElement(params, recoveryIndex, j),
+            dataBlocks[j] + offset, bytes);
+    }
+}
+
+int cauchy_rs_encode_tiled(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    int tileBytes)                // Bytes per tile, or 0 to pick automatically
+{
+    int block, offset, bytes, ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (!parityBlocks || !dataBlocks){
+        return -3;
+    }
+
+    tileBytes = GetTileBytes(params, tileBytes);
+
+    // Compute every recovery row for a tile while the originals are in cache
+    for (offset = 0; offset < params.BlockBytes; offset += tileBytes){
+        bytes = params.BlockBytes - offset;
+        if (bytes > tileBytes){
+            bytes = tileBytes;
+        }
+
+        for (block = 0; block < params.RecoveryCount; ++block){
+            EncodeBlockRange(params, dataBlocks, offset, bytes, block, parityBlocks[block]);
+        }
+    }
+
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Encoder Plan
+
+cauchy_encoder_plan* cauchy_rs_plan_create(cauchy_encoder_params params)
+{
+    cauchy_encoder_plan* plan;
+    int elements, row, col;
+
+    if (CheckParams(params)){
+        return NULL;
+    }
+
+    // One allocation holds the plan, the tables and then the matrix
+    elements = params.OriginalCount * params.RecoveryCount;
+    plan = cauchy_malloc(sizeof(cauchy_encoder_plan) + elements * (sizeof(gf_mul_table) + 1));
+    if (!plan){
+        return NULL;
+    }
+    plan->Params = params;
+    plan->TileBytes = cauchy_get_tile_bytes(params);
+    plan->Tables = (gf_mul_table*)(plan + 1);
+    plan->Matrix = (uint8_t*)(plan->Tables + elements);
+
+    // Row-major, which is the order the encoder walks the matrix
+    for (row = 0; row < params.RecoveryCount; ++row){
+        for (col = 0; col < params.OriginalCount; ++col){
+            uint8_t element = GetEncodeElement(params, row, col);
+
+            plan->Matrix[row * params.OriginalCount + col] = element;
+            gf_mul_table_init(&plan->Tables[row * params.OriginalCount + col], element);
+        }
+    }
+
+    return plan;
+}
+
+void cauchy_rs_plan_free(cauchy_encoder_plan* plan)
+{
+    kfree(plan);
+}
+
+// Encode bytes [offset, offset + bytes) of one recovery block using a row
+// of resolved plan tables
+static void EncodeBlockPlan(
+    const gf_mul_table* row,      // OriginalCount tables for this recovery row
+    int originalCount,
+    uint8_t** dataBlocks,
+    int offset,
+    int bytes,
+    uint8_t* recoveryBlock)
+{
+    int j = 1;
+
+    // XOR rows such as the first one avoid a separate copy pass
+    if (originalCount >= 2 && row[0].Y == 1 && row[1].Y == 1){
+        gf_addset_mem(recoveryBlock + offset, dataBlocks[0] + offset, dataBlocks[1] + offset, bytes);
+        j = 2;
+    } else {
+        gf_mul_mem_table(recoveryBlock + offset, dataBlocks[0] + offset, &row[0], bytes);
+    }
+
+    for (; j < originalCount; ++j){
+        gf_muladd_mem_table(recoveryBlock + offset, &row[j], dataBlocks[j] + offset, bytes);
+    }
+}
+
+// Start loading bytes [offset, offset + bytes) of each block into cache,
+// clipped to blockBytes
+static void PrefetchTile(uint8_t** blocks, int count, int blockBytes, int offset, int bytes)
+{
+    int block, pos;
+
+    if (bytes > blockBytes - offset){
+        bytes = blockBytes - offset;
+    }
+    for (block = 0; block < count; ++block){
+        for (pos = 0; pos < bytes; pos += CAUCHY_CACHE_LINE_BYTES){
+            __builtin_prefetch(blocks[block] + offset + pos);
+        }
+    }
+}
+
+// Encodes a tile at a time.  While a tile is encoded the next one is
+// prefetched, from nextDataBlocks after the last tile if it is not NULL.
+static void EncodeWithPlan(
+    const cauchy_encoder_plan* plan,
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t** nextDataBlocks)
+{
+    const int k = plan->Params.OriginalCount;
+    const int blockBytes = plan->Params.BlockBytes;
+    int block, offset, bytes, tileBytes, ahead;
+
+    // TileBytes can be set by the caller, so round it as encode_tiled does
+    tileBytes = plan->TileBytes > 0 ? GetTileBytes(plan->Params, plan->TileBytes) : blockBytes;
+
+    // An untiled plan still only looks a cache-sized tile ahead
+    ahead = cauchy_get_tile_bytes(plan->Params);
+    if (ahead > tileBytes){
+        ahead = tileBytes;
+    }
+
+    for (offset = 0; offset < blockBytes; offset += tileBytes){
+        bytes = blockBytes - offset;
+        if (bytes > tileBytes){
+            bytes = tileBytes;
+        }
+
+        if (offset + tileBytes < blockBytes){
+            PrefetchTile(dataBlocks, k, blockBytes, offset + tileBytes, ahead);
+        } else if (nextDataBlocks){
+            PrefetchTile(nextDataBlocks, k, blockBytes, 0, ahead);
+        }
+
+        for (block = 0; block < plan->Params.RecoveryCount; ++block){
+            EncodeBlockPlan(plan->Tables + block * k, k, dataBlocks,
+                offset, bytes, parityBlocks[block]);
+        }
+    }
+}
+
+int cauchy_rs_encode_plan(
+    const cauchy_encoder_plan* plan, // From cauchy_rs_plan_create()
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks)
+{
+    if (!plan || !parityBlocks || !dataBlocks){
+        return -3;
+    }
+
+    EncodeWithPlan(plan, dataBlocks, parityBlocks, NULL);
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Batch Encoding
+
+int cauchy_rs_encode_batch(
+    const cauchy_encoder_plan* plan, // From cauchy_rs_plan_create()
+    cauchy_stripe* stripes,
+    int stripeCount)
+{
+    int stripe;
+
+    if (stripeCount < 0){
+        return -1;
+    }
+    if (!plan || !stripes){
+        return -3;
+    }
+
+    // Validate everything up front so a bad stripe does not leave the
+    // batch partially encoded
+    for (stripe = 0; stripe < stripeCount; ++stripe){
+        if (!stripes[stripe].DataBlocks || !stripes[stripe].ParityBlocks){
+            return -3;
+        }
+    }
+
+    // Each stripe prefetches the start of the next one as it finishes
+    for (stripe = 0; stripe < stripeCount; ++stripe){
+        EncodeWithPlan(plan, stripes[stripe].DataBlocks, stripes[stripe].ParityBlocks,
+            stripe + 1 < stripeCount ? stripes[stripe + 1].DataBlocks : NULL);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Streaming Encoder
+
+int cauchy_rs_stream_init(
+    cauchy_stream_encoder* stream,
+    cauchy_encoder_params params,
+    uint8_t** parityBlocks)
+{
+    int ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (!stream || !parityBlocks){
+        return -3;
+    }
+
+    stream->Params = params;
+    stream->ParityBlocks = parityBlocks;
+    stream->Received = 0;
+    memset(stream->ReceivedMask, 0, sizeof(stream->ReceivedMask));
+    return 0;
+}
+
+int cauchy_rs_stream_feed(
+    cauchy_stream_encoder* stream,
+    int originalIndex,
+    const uint8_t* data)
+{
+    const cauchy_encoder_params params = stream->Params;
+    uint8_t bit;
+    int block;
+
+    if (originalIndex < 0 || originalIndex >= params.OriginalCount){
+        return -1;
+    }
+    if (!data){
+        return -3;
+    }
+
+    bit = (uint8_t)(1 << (originalIndex & 7));
+    if (stream->ReceivedMask[originalIndex >> 3] & bit){
+        return -4; // Fed twice
+    }
+
+    // Fold the block into every recovery block while it is cache-hot.
+    // The first block fed sets the recovery blocks instead of adding so
+    // they do not need clearing in advance.
+    for (block = 0; block < params.RecoveryCount; ++block){
+        uint8_t matrixElement = GetEncodeElement(params, block, originalIndex);
+
+        if (stream->Received == 0){
+            gf_mul_mem(stream->ParityBlocks[block], data, matrixElement, params.BlockBytes);
+        } else {
+            gf_muladd_mem(stream->ParityBlocks[block], matrixElement, data, params.BlockBytes);
+        }
+    }
+
+    stream->ReceivedMask[originalIndex >> 3] |= bit;
+    stream->Received++;
+    return 0;
+}
+
+int cauchy_rs_stream_finalize(cauchy_stream_encoder* stream)
+{
+    if (stream->Received != stream->Params.OriginalCount){
+        return -4; // Missing original blocks
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Parity Update
+
+// Shared validation for the entry points that take a subset of columns
+static int CheckColumns(cauchy_encoder_params params, const uint8_t* indices, int count, uint8_t** parityBlocks)
+{
+    int i, ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (count < 0){
+        return -1;
+    }
+    if (!parityBlocks || (count > 0 && !indices)){
+        return -3;
+    }
+    for (i = 0; i < count; ++i){
+        if (indices[i] >= params.OriginalCount){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cauchy_rs_update(
+    cauchy_encoder_params params, // Encoder params
+    const uint8_t* indices,       // Original block indices that changed
+    int count,
+    uint8_t** oldBlocks,          // Previous contents, one per index
+    uint8_t** newBlocks,          // New contents, one per index
+    uint8_t** parityBlocks)       // Parity blocks updated in place
+{
+    int i, block, ret;
+    uint8_t matrixElement;
+
+    ret = CheckColumns(params, indices, count, parityBlocks);
+    if (ret){
+        return ret;
+    }
+    if (count > 0 && (!oldBlocks || !newBlocks)){
+        return -3;
+    }
+
+    // parity += element * (old + new), without materializing the delta
+    for (block = 0; block < params.RecoveryCount; ++block){
+        for (i = 0; i < count; ++i){
+            matrixElement = GetEncodeElement(params, block, indices[i]);
+
+            if (matrixElement == 1){
+                gf_add2_mem(parityBlocks[block], oldBlocks[i], newBlocks[i], params.BlockBytes);
+            } else {
+                gf_muladd_mem(parityBlocks[block], matrixElement, oldBlocks[i], params.BlockBytes);
+                gf_muladd_mem(parityBlocks[block], matrixElement, newBlocks[i], params.BlockBytes);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int cauchy_rs_update_delta(
+    cauchy_encoder_params params, // Encoder params
+    const uint8_t* indices,       // Original block indices that changed
+    int count,
+    uint8_t** deltaBlocks,        // old XOR new, one per index
+    uint8_t** parityBlocks)       // Parity blocks updated in place
+{
+    int i, block, ret;
+
+    ret = CheckColumns(params, indices, count, parityBlocks);
+    if (ret){
+        return ret;
+    }
+    if (count > 0 && !deltaBlocks){
+        return -3;
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        for (i = 0; i < count; ++i){
+            gf_muladd_mem(parityBlocks[block], GetEncodeElement(params, block, indices[i]),
+                deltaBlocks[i], params.BlockBytes);
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Partial Parity
+
+int cauchy_rs_encode_partial(
+    cauchy_encoder_params params, // Encoder params
+    const uint8_t* indices,       // Original block indices held locally
+    int count,
+    uint8_t** dataBlocks,         // One block per index
+    uint8_t** partialBlocks)      // Output partial parity blocks
+{
+    int i, block, ret;
+
+    ret = CheckColumns(params, indices, count, partialBlocks);
+    if (ret){
+        return ret;
+    }
+    if (count > 0 && !dataBlocks){
+        return -3;
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        if (count == 0){
+            memset(partialBlocks[block], 0, params.BlockBytes);
+            continue;
+        }
+
+        gf_mul_mem(partialBlocks[block], dataBlocks[0],
+            GetEncodeElement(params, block, indices[0]), params.BlockBytes);
+
+        for (i = 1; i < count; ++i){
+            gf_muladd_mem(partialBlocks[block], GetEncodeElement(params, block, indices[i]),
+                dataBlocks[i], params.BlockBytes);
+        }
+    }
+
+    return 0;
+}
+
+int cauchy_rs_combine_partial(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t*** shares,            // shareCount arrays of partial parity blocks
+    int shareCount,
+    uint8_t** parityBlocks)       // Output parity blocks
+{
+    int i, block;
+
+    if (params.RecoveryCount <= 0 || params.BlockBytes <= 0 || shareCount <= 0){
+        return -1;
+    }
+    if (!shares || !parityBlocks){
+        return -3;
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        uint8_t* outBlock = parityBlocks[block];
+
+        if (shareCount == 1){
+            memcpy(outBlock, shares[0][block], params.BlockBytes);
+            continue;
+        }
+
+        // Set from the first two shares, then add the rest two at a time
+        gf_addset_mem(outBlock, shares[0][block], shares[1][block], params.BlockBytes);
+        for (i = 2; i + 1 < shareCount; i += 2){
+            gf_add2_mem(outBlock, shares[i][block], shares[i + 1][block], params.BlockBytes);
+        }
+        if (i < shareCount){
+            gf_add_mem(outBlock, shares[i][block], params.BlockBytes);
+        }
+    }
+
+    return 0;
+}
+
+int cauchy_rs_encode_varlen(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    uint8_t** parityBlocks)       // Output recovery blocks, params.BlockBytes each
+{
+    cauchy_block* originals;
+    int block, ret;
+
+    ret = CheckParams(params);
+    if (ret){
+        return ret;
+    }
+    if (!parityBlocks || !dataBlocks || !blockLengths){
+        return -3;
+    }
+    for (block = 0; block < params.OriginalCount; ++block){
+        if (blockLengths[block] < 0 || blockLengths[block] > params.BlockBytes){
+            return -1;
+        }
+    }
+
+    originals = cauchy_malloc(sizeof(cauchy_block) * params.OriginalCount);
+    if (!originals){
+        return -3;
+    }
+
+    for (block = 0; block < params.OriginalCount; ++block){
+        originals[block].Block = dataBlocks[block];
+    }
+
+    for (block = 0; block < params.RecoveryCount; ++block){
+        EncodeBlockVarlen(params, originals, blockLengths, (params.OriginalCount + block), parityBlocks[block]);
+    }
+
+    kfree(originals);
     return 0;
 }
 
@@ -1602,357 +3268,2317 @@ int cauchy_rs_encode(
 //-----------------------------------------------------------------------------
 // Decoding
 
-typedef struct {
-    // Encode parameters
-    cauchy_encoder_params Params;
+// Generate the LU decomposition of the matrix for the given recovery rows
+// (from 0) and erased originals
+void GenerateLDUDecomposition(cauchy_encoder_params params, int N, const uint8_t* recoveryRows,
+    const uint8_t* erasures, uint8_t* matrix_L, uint8_t* diag_D, uint8_t* matrix_U) {
+    // Schur-type-direct-Cauchy algorithm 2.5 from
+    // "Pivoting and Backward Stability of Fast Algorithms for Solving Cauchy Linear Equations"
+    // T. Boros, T. Kailath, V. Olshevsky
+    // Modified for practical use.  I folded the diagonal parts of U/L matrices into the
+    // diagonal one to reduce the number of multiplications to perform against the input data,
+    // and organized the triangle matrices in memory to allow for faster SSE3 GF multiplications.
+
+    // Matrix size NxN
+    int count;
+    int i, firstOffset_U, j, k;
+    uint8_t rotated_row_U[256];
+    uint8_t *last_U, *row_L, *row_U, *output_U;
+    uint8_t x_k, y_k, D_kk, L_kk, U_kk, x_j, y_j, L_jk, U_kj, x_n, y_n, L_nn, U_nn;
+
+    // Generators, starting from the row scaling of the matrix
+    uint8_t g[256], b[256];
+    for (i = 0; i < N; ++i) {
+        g[i] = MatrixRowScale(params, recoveryRows[i]);
+        b[i] = 1;
+    }
+
+    // Temporary buffer for rotated row of U matrix
+    // This allows for faster GF bulk multiplication
+    last_U = matrix_U + ((N - 1) * N) / 2 - 1;
+    firstOffset_U = 0;
+
+    // The column scaling c_j plays the part of (x_0 + y_j) in the default matrix.
+
+    // Unrolling k = 0 just makes it slower for some reason.
+    for (k = 0; k < N - 1; ++k) {
+        x_k = MatrixX(params, recoveryRows[k]);
+        y_k = MatrixY(params, erasures[k]);
+
+        // D_kk = (x_k + y_k)
+        // L_kk = g[k] / (x_k + y_k)
+        // U_kk = b[k] * c_k / (x_k + y_k)
+        D_kk = gf_add(x_k, y_k);
+        L_kk = gf_div(g[k], D_kk);
+        U_kk = gf_mul(gf_div(b[k], D_kk), MatrixColScale(params, erasures[k]));
+
+        // diag_D[k] = D_kk * L_kk * U_kk
+        diag_D[k] = gf_mul(D_kk, gf_mul(L_kk, U_kk));
+
+        // Computing the k-th row of L and U
+        row_L = matrix_L;
+        row_U = rotated_row_U;
+        for (j = k + 1; j < N; ++j) {
+            x_j = MatrixX(params, recoveryRows[j]);
+            y_j = MatrixY(params, erasures[j]);
+
+            // L_jk = g[j] / (x_j + y_k)
+            // U_kj = b[j] / (x_k + y_j)
+            L_jk = gf_div(g[j], gf_add(x_j, y_k));
+            U_kj = gf_div(b[j], gf_add(x_k, y_j));
+
+            *matrix_L++ = L_jk;
+            *row_U++ = U_kj;
+
+            // g[j] = g[j] * (x_j + x_k) / (x_j + y_k)
+            // b[j] = b[j] * (y_j + y_k) / (y_j + x_k)
+            g[j] = gf_mul(g[j], gf_div(gf_add(x_j, x_k), gf_add(x_j, y_k)));
+            b[j] = gf_mul(b[j], gf_div(gf_add(y_j, y_k), gf_add(y_j, x_k)));
+        }
+
+        // Do these row/column divisions in bulk for speed.
+        // L_jk /= L_kk
+        // U_kj /= U_kk
+        count = N - (k + 1);
+        gf_div_mem(row_L, row_L, L_kk, count);
+        gf_div_mem(rotated_row_U, rotated_row_U, U_kk, count);
+
+        // Copy U matrix row into place in memory.
+        output_U = last_U + firstOffset_U;
+        row_U = rotated_row_U;
+        for (j = k + 1; j < N; ++j) {
+            *output_U = *row_U++;
+            output_U -= j;
+        }
+        firstOffset_U -= k + 2;
+    }
+
+    // Multiply diagonal matrix into U
+    row_U = matrix_U;
+    for (j = N - 1; j > 0; --j) {
+        count = j;
+
+        gf_mul_mem(row_U, row_U, MatrixColScale(params, erasures[j]), count);
+        row_U += count;
+    }
+
+    x_n = MatrixX(params, recoveryRows[N - 1]);
+    y_n = MatrixY(params, erasures[N - 1]);
+
+    // D_nn = 1 / (x_n + y_n)
+    // L_nn = g[N-1]
+    // U_nn = b[N-1] * c_n
+    L_nn = g[N - 1];
+    U_nn = gf_mul(b[N - 1], MatrixColScale(params, erasures[N - 1]));
+
+    // diag_D[N-1] = L_nn * D_nn * U_nn
+    diag_D[N - 1] = gf_div(gf_mul(L_nn, U_nn), gf_add(x_n, y_n));
+}
+
+/*
+    Decoder plans
+
+    Everything Decode() needs besides the data depends only on the erasure
+    pattern: which originals are erased, which recovery rows stand in for
+    them, and the surviving originals.  A plan holds the LDU decomposition
+    for a pattern along with resolved multiply tables for the elimination
+    of the survivors and for L * D, D^-1 and U, so applying it does no
+    matrix work and no allocation.
+
+    Plans for the default matrix are kept in a small cache, since every
+    stripe decoded during a device failure shares one pattern.  Lookups take
+    the read side of a rwlock; plans are built outside the lock and then
+    inserted, replacing the oldest entry.  Each plan is reference counted so
+    an entry can be evicted while another thread is still decoding with it.
+*/
+typedef struct {
+    // Encode parameters the plan was built for, BlockBytes is not used
+    cauchy_encoder_params Params;
+
+    // Number of erasures, N
+    int N;
+
+    // Bytes of each block Decode() works through at a time
+    int TileBytes;
+
+    // Erased originals in ascending order, and the recovery row (from 0)
+    // that stands in for each
+    uint8_t Erasures[256];
+    uint8_t RecoveryRows[256];
+
+    // Surviving originals in ascending order, OriginalCount - N of them
+    uint8_t Originals[256];
+
+    // Decomposition laid out as Decode() consumes it
+    uint8_t* Matrix_L;   // N(N-1)/2, column-first, top-down
+    uint8_t* Diag_D;     // N
+    uint8_t* Matrix_U;   // N(N-1)/2, column-first, bottom-up
+
+    // Tables for the above
+    gf_mul_table* Eliminate;  // Per surviving original, per recovery row
+    gf_mul_table* Table_LD;   // L_ij * D_j, in the order of Matrix_L
+    gf_mul_table* Table_DInv;
+    gf_mul_table* Table_U;
+
+    uint32_t Hash;
+    atomic_t RefCount;
+} DecoderPlan;
+
+static DEFINE_RWLOCK(DecoderPlanLock);
+static DecoderPlan* DecoderPlanCache[CAUCHY_DECODE_CACHE_ENTRIES];
+static int DecoderPlanNext; // Entry replaced next, under the write lock
+
+static uint32_t DecoderPlanHash(cauchy_encoder_params params, int N, const uint8_t* erasures, const uint8_t* recoveryRows)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    int i;
+
+    hash = (hash ^ (uint32_t)(params.OriginalCount)) * 16777619u;
+    hash = (hash ^ (uint32_t)(params.RecoveryCount)) * 16777619u;
+    for (i = 0; i < N; ++i) {
+        hash = (hash ^ erasures[i]) * 16777619u;
+        hash = (hash ^ recoveryRows[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static DecoderPlan* BuildDecoderPlan(cauchy_encoder_params params, int N, const uint8_t* erasures, const uint8_t* recoveryRows)
+{
+    const int k = params.OriginalCount;
+    const int triangle = N * (N - 1) / 2;
+    DecoderPlan* plan;
+    uint8_t erased[256];
+    int i, j, o, r;
+
+    plan = cauchy_malloc(sizeof(DecoderPlan) + N * N
+        + sizeof(gf_mul_table) * ((k - N) * N + N * N));
+    if (!plan) {
+        return NULL;
+    }
+
+    plan->Params = params;
+    plan->N = N;
+    plan->TileBytes = cauchy_get_tile_bytes(params);
+    memcpy(plan->Erasures, erasures, N);
+    memcpy(plan->RecoveryRows, recoveryRows, N);
+    atomic_set(&plan->RefCount, 1);
+
+    memset(erased, 0, k);
+    for (i = 0; i < N; ++i) {
+        erased[erasures[i]] = 1;
+    }
+    for (i = 0, o = 0; i < k; ++i) {
+        if (!erased[i]) {
+            plan->Originals[o++] = (uint8_t)(i);
+        }
+    }
+
+    // Tables first so they stay aligned, then the raw matrices
+    plan->Eliminate = (gf_mul_table*)(plan + 1);
+    plan->Table_LD = plan->Eliminate + (k - N) * N;
+    plan->Table_DInv = plan->Table_LD + triangle;
+    plan->Table_U = plan->Table_DInv + N;
+    plan->Matrix_U = (uint8_t*)(plan->Table_U + triangle);
+    plan->Diag_D = plan->Matrix_U + triangle;
+    plan->Matrix_L = plan->Diag_D + N;
+
+    for (o = 0; o < k - N; ++o) {
+        for (r = 0; r < N; ++r) {
+            gf_mul_table_init(&plan->Eliminate[o * N + r],
+                GetEncodeElement(params, recoveryRows[r], plan->Originals[o]));
+        }
+    }
+
+    /*
+        Compute matrix decomposition:
+
+            G = L * D * U
+
+        L is lower-triangular, diagonal is all ones.
+        D is a diagonal matrix.
+        U is upper-triangular, diagonal is all ones.
+    */
+    GenerateLDUDecomposition(params, N, recoveryRows, erasures, plan->Matrix_L, plan->Diag_D, plan->Matrix_U);
+
+    for (j = 0, i = 0; j < N - 1; ++j) {
+        for (r = j + 1; r < N; ++r, ++i) {
+            gf_mul_table_init(&plan->Table_LD[i], gf_mul(plan->Matrix_L[i], plan->Diag_D[j]));
+        }
+    }
+    for (i = 0; i < triangle; ++i) {
+        gf_mul_table_init(&plan->Table_U[i], plan->Matrix_U[i]);
+    }
+    for (i = 0; i < N; ++i) {
+        gf_mul_table_init(&plan->Table_DInv[i], gf_inv(plan->Diag_D[i]));
+    }
+
+    return plan;
+}
+
+static void DecoderPlanPut(DecoderPlan* plan)
+{
+    if (plan && atomic_dec_and_test(&plan->RefCount)) {
+        kfree(plan);
+    }
+}
+
+// Called with DecoderPlanLock held
+static DecoderPlan* DecoderPlanFind(uint32_t hash, cauchy_encoder_params params, int N,
+    const uint8_t* erasures, const uint8_t* recoveryRows)
+{
+    DecoderPlan* plan;
+    int i;
+
+    for (i = 0; i < CAUCHY_DECODE_CACHE_ENTRIES; ++i) {
+        plan = DecoderPlanCache[i];
+        if (plan && plan->Hash == hash && plan->N == N &&
+            plan->Params.OriginalCount == params.OriginalCount &&
+            plan->Params.RecoveryCount == params.RecoveryCount &&
+            !memcmp(plan->Erasures, erasures, N) &&
+            !memcmp(plan->RecoveryRows, recoveryRows, N)) {
+            return plan;
+        }
+    }
+    return NULL;
+}
+
+// Returns a referenced plan for the pattern, or NULL if allocation fails.
+// Plans for a caller-provided matrix are not cached, since the matrix may
+// change or be freed once the call returns.
+static DecoderPlan* DecoderPlanGet(cauchy_encoder_params params, int N,
+    const uint8_t* erasures, const uint8_t* recoveryRows)
+{
+    const uint32_t hash = DecoderPlanHash(params, N, erasures, recoveryRows);
+    DecoderPlan *plan, *found, *victim;
+
+    if (!params.Matrix) {
+        read_lock(&DecoderPlanLock);
+        plan = DecoderPlanFind(hash, params, N, erasures, recoveryRows);
+        if (plan) {
+            atomic_inc(&plan->RefCount);
+        }
+        read_unlock(&DecoderPlanLock);
+        if (plan) {
+            return plan;
+        }
+    }
+
+    plan = BuildDecoderPlan(params, N, erasures, recoveryRows);
+    if (!plan || params.Matrix) {
+        return plan;
+    }
+    plan->Hash = hash;
+
+    // One reference for the cache and one for the caller
+    atomic_inc(&plan->RefCount);
+
+    write_lock(&DecoderPlanLock);
+    found = DecoderPlanFind(hash, params, N, erasures, recoveryRows);
+    if (found) {
+        // Another thread got there first
+        atomic_inc(&found->RefCount);
+        write_unlock(&DecoderPlanLock);
+        kfree(plan);
+        return found;
+    }
+    victim = DecoderPlanCache[DecoderPlanNext];
+    DecoderPlanCache[DecoderPlanNext] = plan;
+    DecoderPlanNext = (DecoderPlanNext + 1) % CAUCHY_DECODE_CACHE_ENTRIES;
+    write_unlock(&DecoderPlanLock);
+
+    DecoderPlanPut(victim);
+    return plan;
+}
+
+void cauchy_rs_decode_cache_clear(void)
+{
+    DecoderPlan* evicted[CAUCHY_DECODE_CACHE_ENTRIES];
+    int i;
+
+    write_lock(&DecoderPlanLock);
+    for (i = 0; i < CAUCHY_DECODE_CACHE_ENTRIES; ++i) {
+        evicted[i] = DecoderPlanCache[i];
+        DecoderPlanCache[i] = NULL;
+    }
+    DecoderPlanNext = 0;
+    write_unlock(&DecoderPlanLock);
+
+    for (i = 0; i < CAUCHY_DECODE_CACHE_ENTRIES; ++i) {
+        DecoderPlanPut(evicted[i]);
+    }
+}
+
+// Row i of a decode for the slice at offset: its tile of scratch if there
+// is one, else the output for plan->Erasures[i].  outBlocks is in the order
+// the erasures were given, so that is outBlocks[plan->RecoveryRows[i]], or
+// the erased original itself if outBlocks is NULL.
+static FORCE_INLINE uint8_t* DecodeRow(const DecoderPlan* plan, uint8_t** dataBlocks, uint8_t** outBlocks,
+    uint8_t* scratch, int i, int offset)
+{
+    if (scratch) {
+        return scratch + i * plan->TileBytes;
+    }
+    return (outBlocks ? outBlocks[plan->RecoveryRows[i]] : dataBlocks[plan->Erasures[i]]) + offset;
+}
+
+// Decodes bytes [offset, offset + bytes) of the inputs into the rows given
+// by DecodeRow(), taking every phase through the slice before moving on.
+// parityBlocks is indexed by recovery row and is left untouched.
+static void DecodeRange(const DecoderPlan* plan, uint8_t** dataBlocks, const int* blockLengths,
+    uint8_t** parityBlocks, uint8_t** outBlocks, uint8_t* scratch, int offset, int bytes) {
+    // Matrix size is NxN, where N is the number of recovery blocks used.
+    const int N = plan->N;
+    const gf_mul_table *table_LD = plan->Table_LD, *table_U = plan->Table_U;
+
+    int originalIndex, recoveryIndex, j, i, inBytes;
+    uint8_t *inBlock, *row, *parity;
+    uint8_t inRow;
+
+    // Working rows are set from the parity by the first original
+    int seeded = 0;
+
+    // Eliminate original data from the the recovery rows
+    for (originalIndex = 0; originalIndex < plan->Params.OriginalCount - N; ++originalIndex) {
+        inRow = plan->Originals[originalIndex];
+        inBlock = dataBlocks[inRow] + offset;
+
+        // Shorter originals are zero past their length
+        inBytes = bytes;
+        if (blockLengths && blockLengths[inRow] - offset < inBytes) {
+            inBytes = blockLengths[inRow] - offset;
+            if (inBytes <= 0) {
+                continue;
+            }
+        }
+
+        for (recoveryIndex = 0; recoveryIndex < N; ++recoveryIndex) {
+            row = DecodeRow(plan, dataBlocks, outBlocks, scratch, recoveryIndex, offset);
+            parity = parityBlocks[plan->RecoveryRows[recoveryIndex]] + offset;
+            if (seeded) {
+                gf_muladd_mem_table(row, &plan->Eliminate[originalIndex * N + recoveryIndex], inBlock, inBytes);
+            } else if (inBytes == bytes) {
+                gf_muladdset_mem_table(row, parity, &plan->Eliminate[originalIndex * N + recoveryIndex],
+                    inBlock, bytes);
+            } else {
+                memcpy(row, parity, bytes);
+                gf_muladd_mem_table(row, &plan->Eliminate[originalIndex * N + recoveryIndex], inBlock, inBytes);
+            }
+        }
+        seeded = 1;
+    }
+    if (!seeded) {
+        for (recoveryIndex = 0; recoveryIndex < N; ++recoveryIndex) {
+            memcpy(DecodeRow(plan, dataBlocks, outBlocks, scratch, recoveryIndex, offset),
+                parityBlocks[plan->RecoveryRows[recoveryIndex]] + offset, bytes);
+        }
+    }
+
+    /*
+        Eliminate lower left triangle and diagonal.
+
+        Row j is final once the columns before it are eliminated, so it is
+        divided by D_j right away and the rows below use L_ij * D_j instead
+        of L_ij.
+    */
+    // For each column,
+    for (j = 0; j < N; ++j) {
+        row = DecodeRow(plan, dataBlocks, outBlocks, scratch, j, offset);
+        gf_mul_mem_table_inplace(row, &plan->Table_DInv[j], bytes);
+
+        // For each row,
+        for (i = j + 1; i < N; ++i) {
+            // Matrix elements are stored column-first, top-down.
+            gf_muladd_mem_table(DecodeRow(plan, dataBlocks, outBlocks, scratch, i, offset), table_LD++, row, bytes);
+        }
+    }
+
+    /*
+        Eliminate upper right triangle.
+    */
+    for (j = N - 1; j >= 1; --j) {
+        row = DecodeRow(plan, dataBlocks, outBlocks, scratch, j, offset);
+        for (i = j - 1; i >= 0; --i) {
+            // Matrix elements are stored column-first, bottom-up.
+            gf_muladd_mem_table(DecodeRow(plan, dataBlocks, outBlocks, scratch, i, offset), table_U++, row, bytes);
+        }
+    }
+}
+
+// Decodes into the rows given by DecodeRow(), original plan->Erasures[i]
+// going to row i.  Works a cache-sized slice at a time so each block is read
+// from memory once.
+static void Decode(const DecoderPlan* plan, uint8_t** dataBlocks, uint8_t** parityBlocks,
+    uint8_t** outBlocks, int blockBytes) {
+    int offset, bytes;
+
+    for (offset = 0; offset < blockBytes; offset += plan->TileBytes) {
+        bytes = blockBytes - offset;
+        if (bytes > plan->TileBytes) {
+            bytes = plan->TileBytes;
+        }
+        DecodeRange(plan, dataBlocks, NULL, parityBlocks, outBlocks, NULL, offset, bytes);
+    }
+}
+
+// Erased originals in ascending order, each with the parity row given for
+// it.  Returns the number of erasures, or -1 if one repeats.
+static int SortErasures(
+    cauchy_encoder_params params,
+    const uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t* sorted,
+    uint8_t* rows)
+{
+    uint8_t position[256];
+    int i, n;
+
+    memset(position, 0xff, params.OriginalCount);
+    for (i = 0; i < num_erasures; i++) {
+        if (position[erasures[i]] != 0xff) {
+            return -1;
+        }
+        position[erasures[i]] = (uint8_t)(i);
+    }
+    for (i = 0, n = 0; i < params.OriginalCount; ++i) {
+        if (position[i] != 0xff) {
+            sorted[n] = (uint8_t)(i);
+            rows[n] = position[i];
+            ++n;
+        }
+    }
+    return n;
+}
+
+// Checks shared by the decoders, of the params and then of the erasures
+static int CheckDecodeParams(cauchy_encoder_params params, const uint8_t* erasures, uint8_t num_erasures)
+{
+    int i, ret;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (num_erasures > params.RecoveryCount) {
+        return -1;
+    }
+    for (i = 0; i < num_erasures; i++) {
+        if (erasures[i] >= params.OriginalCount) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Decode one stripe with a plan, writing original plan->Erasures[i] where
+// DecodeRow() puts it.
+// Returns 0, or -3 if scratch for short originals cannot be allocated.
+static int DecodeStripe(
+    const DecoderPlan* plan,
+    cauchy_encoder_params params,
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    uint8_t** parityBlocks,
+    uint8_t** outBlocks)
+{
+    uint8_t *base, *scratch;
+    int i, offset, bytes, len;
+
+    // Full-length originals are decoded straight into their output buffers
+    if (!blockLengths) {
+        Decode(plan, dataBlocks, parityBlocks, outBlocks, params.BlockBytes);
+        return 0;
+    }
+
+    // Shorter ones may not have room for the whole row, so each slice is
+    // worked in a tile of scratch per row and only the valid bytes are
+    // copied out
+    base = cauchy_malloc(plan->TileBytes * plan->N + GF_ALIGN_BYTES - 1);
+    if (!base) {
+        return -3;
+    }
+    scratch = (uint8_t*)(((uintptr_t)base + GF_ALIGN_BYTES - 1) & ~(uintptr_t)(GF_ALIGN_BYTES - 1));
+
+    for (offset = 0; offset < params.BlockBytes; offset += plan->TileBytes) {
+        bytes = params.BlockBytes - offset;
+        if (bytes > plan->TileBytes) {
+            bytes = plan->TileBytes;
+        }
+        DecodeRange(plan, dataBlocks, blockLengths, parityBlocks, outBlocks, scratch, offset, bytes);
+
+        for (i = 0; i < plan->N; ++i) {
+            len = blockLengths[plan->Erasures[i]] - offset;
+            if (len > bytes) {
+                len = bytes;
+            }
+            if (len > 0) {
+                memcpy(DecodeRow(plan, dataBlocks, outBlocks, NULL, i, offset),
+                    scratch + i * plan->TileBytes, len);
+            }
+        }
+    }
+
+    kfree(base);
+    return 0;
+}
+
+// An inverse decode ready to apply, in one allocation freed with kfree()
+typedef struct {
+    // Erasures decoded, each with OriginalCount tables over the inputs
+    int Count;
+    gf_mul_table* Tables;
+
+    // Room for the block pointers of one stripe
+    uint8_t** Inputs;   // OriginalCount
+    uint8_t** Outputs;  // Count
+
+    // Block index of each input, from InverseInputs()
+    uint8_t Order[256];
+} InversePlan;
+
+// Defined with the inverse decoder below
+static int InverseDecode(cauchy_encoder_params params, uint8_t** dataBlocks, uint8_t** parityBlocks,
+    const uint8_t* sorted, const uint8_t* rows, int n, uint8_t** outBlocks);
+static InversePlan* InversePlanCreate(cauchy_encoder_params params, const uint8_t* sorted, const uint8_t* rows,
+    int n, uint8_t** outputs);
+static void InversePlanBlocks(cauchy_encoder_params params, InversePlan* plan, uint8_t** dataBlocks,
+    uint8_t** parityBlocks);
+static void InverseApply(cauchy_encoder_params params, const InversePlan* plan, int blockBytes);
+static void InverseInputs(cauchy_encoder_params params, const uint8_t* sorted, const uint8_t* rows, int n,
+    uint8_t* order);
+
+// One erasure against the first parity row, which is all ones, so the lost
+// original is the XOR of that parity and every surviving original.  Written
+// to outBlock without touching the parity.
+static void DecodeOneXor(
+    cauchy_encoder_params params,
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    const uint8_t* parity,
+    int erased,
+    uint8_t* outBlock)
+{
+    const int tileBytes = cauchy_get_tile_bytes(params);
+    const int blockBytes = BlockLength(params, blockLengths, erased);
+    const uint8_t* inBlock;
+    int offset, bytes, ii, len;
+
+    // Originals of varying length are added one at a time
+    if (blockLengths) {
+        memcpy(outBlock, parity, blockBytes);
+        for (ii = 0; ii < params.OriginalCount; ++ii) {
+            len = blockLengths[ii] < blockBytes ? blockLengths[ii] : blockBytes;
+            if (ii != erased) {
+                gf_add_mem(outBlock, dataBlocks[ii], len);
+            }
+        }
+        return;
+    }
+
+    for (offset = 0; offset < blockBytes; offset += tileBytes) {
+        bytes = blockBytes - offset;
+        if (bytes > tileBytes) {
+            bytes = tileBytes;
+        }
+
+        // The parity and the first survivor set the output, the rest are
+        // added two at a time
+        inBlock = parity + offset;
+        for (ii = 0; ii < params.OriginalCount; ++ii) {
+            if (ii == erased) {
+                continue;
+            }
+            if (!inBlock) {
+                inBlock = dataBlocks[ii] + offset;
+            } else if (inBlock == parity + offset) {
+                gf_addset_mem(outBlock + offset, inBlock, dataBlocks[ii] + offset, bytes);
+                inBlock = NULL;
+            } else {
+                gf_add2_mem(outBlock + offset, inBlock, dataBlocks[ii] + offset, bytes);
+                inBlock = NULL;
+            }
+        }
+
+        // Complete XORs
+        if (inBlock == parity + offset) {
+            memcpy(outBlock + offset, inBlock, bytes);
+        } else if (inBlock) {
+            gf_add_mem(outBlock + offset, inBlock, bytes);
+        }
+    }
+}
+
+// Nonzero if any of the count pointers is NULL
+static int SomeNull(uint8_t** blocks, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (!blocks[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Decode sorted erasures with the parity rows given for them.  outBlocks is
+// NULL to decode in place, or in the order the erasures were given, as by
+// SortErasures(), with sorted[i] going to outBlocks[rows[i]] unless that is
+// NULL.  Picks the cheapest decoder:
+// XOR for parity 0 alone, the inverse for up to two erasures or a subset,
+// and otherwise the plan for the erasure pattern.
+static int DecodeSorted(
+    cauchy_encoder_params params,
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    uint8_t** parityBlocks,
+    const uint8_t* sorted,
+    const uint8_t* rows,
+    int n,
+    uint8_t** outBlocks)
+{
+    DecoderPlan* plan;
+    uint8_t* out;
+    int ret;
+
+    // A single erasure against the first parity row, whatever m is
+    if (n == 1 && rows[0] == 0) {
+        out = outBlocks ? outBlocks[rows[0]] : dataBlocks[sorted[0]];
+        if (out) {
+            DecodeOneXor(params, dataBlocks, blockLengths, parityBlocks[0], sorted[0], out);
+        }
+        return 0;
+    }
+
+    // One or two erasures invert in closed form and decode in a single pass,
+    // and the inverse rows also give any subset of the erasures on its own
+    if (!blockLengths && (n <= 2 || (outBlocks && SomeNull(outBlocks, n)))) {
+        return InverseDecode(params, dataBlocks, parityBlocks, sorted, rows, n, outBlocks);
+    }
+
+    plan = DecoderPlanGet(params, n, sorted, rows);
+    if (!plan) {
+        return -3;
+    }
+
+    ret = DecodeStripe(plan, params, dataBlocks, blockLengths, parityBlocks, outBlocks);
+
+    DecoderPlanPut(plan);
+    return ret;
+}
+
+// Cost of decoding with a parity row for the multiply kernels.  A zero
+// coefficient is skipped and a one is a plain XOR, while every other value
+// costs the same table lookup, so only those are counted.  The all-ones
+// first row costs nothing and always comes first.
+static int ParityRowCost(cauchy_encoder_params params, int row)
+{
+    int j, cost = 0;
+
+    for (j = 0; j < params.OriginalCount; ++j) {
+        cost += GetEncodeElement(params, row, j) > 1;
+    }
+    return cost;
+}
+
+// Erased originals in ascending order, with the cheapest of the available
+// parity rows in ascending order.  Parity row j is available if available is
+// NULL or available[j] is nonzero, and parityBlocks is NULL or
+// parityBlocks[j] is not.  Returns the number of erasures, or -1 if one
+// repeats or there is not enough parity.
+static int RepairRows(
+    cauchy_encoder_params params,
+    const uint8_t* available,
+    uint8_t** parityBlocks,
+    const uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t* sorted,
+    uint8_t* rows)
+{
+    // A row cost is at most OriginalCount, leaving the top values as marks
+    const uint16_t unusable = 0xffff, chosen = 0xfffe;
+    uint16_t cost[255];
+    int i, j, n, best;
+
+    n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    if (n <= 0) {
+        return n;
+    }
+
+    for (j = 0; j < params.RecoveryCount; ++j) {
+        if ((available && !available[j]) || (parityBlocks && !parityBlocks[j])) {
+            cost[j] = unusable;
+        } else {
+            cost[j] = (uint16_t)(ParityRowCost(params, j));
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        for (j = 0, best = -1; j < params.RecoveryCount; ++j) {
+            if (cost[j] < chosen && (best < 0 || cost[j] < cost[best])) {
+                best = j;
+            }
+        }
+        if (best < 0) {
+            return -1;
+        }
+        cost[best] = chosen;
+    }
+
+    // Ascending rows keep the plan cache key the same for a pattern
+    for (j = 0, i = 0; j < params.RecoveryCount; ++j) {
+        if (cost[j] == chosen) {
+            rows[i++] = (uint8_t)(j);
+        }
+    }
+    return n;
+}
+
+// Shared body of the decode entry points; erasures[i] goes to outBlocks[i]
+// if it is not NULL.  With cheapest set the cheapest of the parity blocks
+// that are not NULL are used, and outBlocks must be NULL.
+static int DecodeBlocks(
+    cauchy_encoder_params params,
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t** outBlocks,
+    int cheapest)
+{
+    uint8_t sorted[256], rows[256];
+    int n, ret;
+
+    ret = CheckDecodeParams(params, erasures, num_erasures);
+    if (ret) {
+        return ret;
+    }
+
+    // If nothing is erased,
+    if (num_erasures == 0) {
+        return 0;
+    }
+
+    if (cheapest) {
+        // rows[i] is then a parity row rather than a position
+        n = RepairRows(params, NULL, parityBlocks, erasures, num_erasures, sorted, rows);
+    } else {
+        n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    }
+    if (n < 0) {
+        return -1;
+    }
+
+    // rows[i] is where sorted[i] was in erasures, and so in outBlocks
+    return DecodeSorted(params, dataBlocks, blockLengths, parityBlocks, sorted, rows, n, outBlocks);
+}
+
+int cauchy_rs_decode(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures)         // Array of 'originalCount' blocks as described above
+{
+    if (params.Code == CAUCHY_CODE_RAID6) {
+        return Raid6Decode(params, dataBlocks, parityBlocks, erasures, num_erasures);
+    }
+    return DecodeBlocks(params, dataBlocks, NULL, parityBlocks, erasures, num_erasures, NULL, 0);
+}
+
+// Pointer table entries decode_strided() keeps on the stack, enough for the
+// k survivors and the parity of the usual small codes
+#define CAUCHY_STRIDED_BLOCKS 32
+
+int cauchy_rs_decode_strided(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t* data,                // First data block
+    int dataStride,               // Bytes between data blocks
+    uint8_t* parity,              // First parity block
+    int parityStride,             // Bytes between parity blocks
+    uint8_t* erasures,
+    uint8_t num_erasures)
+{
+    uint8_t* local[CAUCHY_STRIDED_BLOCKS];
+    uint8_t** blocks = local;
+    int i, count, ret;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (!data || !parity) {
+        return -3;
+    }
+    if (dataStride < params.BlockBytes || parityStride < params.BlockBytes) {
+        return -1;
+    }
+    if (num_erasures > params.RecoveryCount) {
+        return -1;
+    }
+
+    // Erasure i is decoded from parity i, so only the first num_erasures
+    // parity blocks are read
+    count = params.OriginalCount + num_erasures;
+    if (count > CAUCHY_STRIDED_BLOCKS) {
+        blocks = cauchy_malloc(sizeof(uint8_t*) * count);
+        if (!blocks) {
+            return -3;
+        }
+    }
+    for (i = 0; i < params.OriginalCount; ++i) {
+        blocks[i] = data + (long)i * dataStride;
+    }
+    for (i = 0; i < num_erasures; ++i) {
+        blocks[params.OriginalCount + i] = parity + (long)i * parityStride;
+    }
+
+    ret = DecodeBlocks(params, blocks, NULL, blocks + params.OriginalCount, erasures, num_erasures, NULL, 0);
+    if (blocks != local) {
+        kfree(blocks);
+    }
+    return ret;
+}
+
+int cauchy_rs_decode_varlen(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    const int* blockLengths,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures)
+{
+    int i;
+
+    if (!blockLengths) {
+        return -3;
+    }
+    for (i = 0; i < params.OriginalCount; ++i) {
+        if (blockLengths[i] < 0 || blockLengths[i] > params.BlockBytes) {
+            return -1;
+        }
+    }
+    return DecodeBlocks(params, dataBlocks, blockLengths, parityBlocks, erasures, num_erasures, NULL, 0);
+}
+
+int cauchy_rs_decode_to(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t** outBlocks)
+{
+    if (!outBlocks) {
+        return -3;
+    }
+    return DecodeBlocks(params, dataBlocks, NULL, parityBlocks, erasures, num_erasures, outBlocks, 0);
+}
+
+int cauchy_rs_decode_range(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures,
+    int offset,                   // First byte of the window
+    int bytes,                    // Bytes in the window
+    uint8_t** outBlocks)
+{
+    cauchy_encoder_params window = params;
+    uint8_t** blocks;
+    int i, ret;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (!dataBlocks || !parityBlocks || !outBlocks) {
+        return -3;
+    }
+    if (offset < 0 || bytes <= 0 || offset > params.BlockBytes - bytes || (offset & (GF_ALIGN_BYTES - 1))) {
+        return -1;
+    }
+
+    // The window is decoded as if it were the whole block
+    blocks = cauchy_malloc(sizeof(uint8_t*) * (params.OriginalCount + params.RecoveryCount));
+    if (!blocks) {
+        return -3;
+    }
+    for (i = 0; i < params.OriginalCount; ++i) {
+        blocks[i] = dataBlocks[i] ? dataBlocks[i] + offset : NULL;
+    }
+    for (i = 0; i < params.RecoveryCount; ++i) {
+        blocks[params.OriginalCount + i] = parityBlocks[i] ? parityBlocks[i] + offset : NULL;
+    }
+    window.BlockBytes = bytes;
+
+    ret = DecodeBlocks(window, blocks, NULL, blocks + params.OriginalCount, erasures, num_erasures, outBlocks, 0);
+
+    kfree(blocks);
+    return ret;
+}
+
+// Nonzero if the sector is marked in a per-sector erasure map
+static FORCE_INLINE int SectorErased(const uint8_t* map, int sector){
+    return map && ((map[sector >> 3] >> (sector & 7)) & 1);
+}
+
+// Erased originals of a sector in ascending order, with the first intact
+// parity rows to recover them from.  Returns the number of erased originals,
+// or -1 if there are more than intact parity rows.
+static int SectorPattern(
+    cauchy_encoder_params params,
+    uint8_t** parityBlocks,
+    const uint8_t* const* sectorMaps,
+    int sector,
+    uint8_t* sorted,
+    uint8_t* rows)
+{
+    int i, n, r;
+
+    for (i = 0, n = 0; i < params.OriginalCount; ++i) {
+        if (SectorErased(sectorMaps[i], sector)) {
+            sorted[n++] = (uint8_t)(i);
+        }
+    }
+    for (i = 0, r = 0; i < params.RecoveryCount && r < n; ++i) {
+        if (parityBlocks[i] && !SectorErased(sectorMaps[params.OriginalCount + i], sector)) {
+            rows[r++] = (uint8_t)(i);
+        }
+    }
+    return r < n ? -1 : n;
+}
+
+// Nonzero if two sectors have the same blocks erased
+static int SameSectorPattern(cauchy_encoder_params params, const uint8_t* const* sectorMaps, int a, int b)
+{
+    int i;
+
+    for (i = 0; i < params.OriginalCount + params.RecoveryCount; ++i) {
+        if (SectorErased(sectorMaps[i], a) != SectorErased(sectorMaps[i], b)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int cauchy_rs_decode_sectors(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    const uint8_t* const* sectorMaps,
+    int sectorBytes)
+{
+    cauchy_encoder_params window = params;
+    uint8_t sorted[256], rows[256];
+    uint8_t** blocks;
+    int sectors, sector, next, offset, end, i, n, ret = 0;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (!dataBlocks || !parityBlocks || !sectorMaps) {
+        return -3;
+    }
+    if (sectorBytes <= 0 || (sectorBytes & (GF_ALIGN_BYTES - 1))) {
+        return -1;
+    }
+
+    // Fail before writing anything if a sector cannot be recovered
+    sectors = (params.BlockBytes - 1) / sectorBytes + 1;
+    for (sector = 0; sector < sectors; ++sector) {
+        if (SectorPattern(params, parityBlocks, sectorMaps, sector, sorted, rows) < 0) {
+            return -1;
+        }
+    }
+
+    blocks = cauchy_malloc(sizeof(uint8_t*) * (params.OriginalCount + params.RecoveryCount));
+    if (!blocks) {
+        return -3;
+    }
+
+    // Each run of sectors with the same pattern is one decode of its own
+    for (sector = 0; sector < sectors && !ret; sector = next) {
+        n = SectorPattern(params, parityBlocks, sectorMaps, sector, sorted, rows);
+        for (next = sector + 1; next < sectors && SameSectorPattern(params, sectorMaps, sector, next); ++next) {
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        offset = sector * sectorBytes;
+        end = next < sectors ? next * sectorBytes : params.BlockBytes;
+        window.BlockBytes = end - offset;
+
+        for (i = 0; i < params.OriginalCount; ++i) {
+            blocks[i] = dataBlocks[i] + offset;
+        }
+        for (i = 0; i < params.RecoveryCount; ++i) {
+            blocks[params.OriginalCount + i] = parityBlocks[i] ? parityBlocks[i] + offset : NULL;
+        }
+
+        ret = DecodeSorted(window, blocks, NULL, blocks + params.OriginalCount, sorted, rows, n, NULL);
+    }
+
+    kfree(blocks);
+    return ret;
+}
+
+int cauchy_rs_decode_any(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures)
+{
+    if (!dataBlocks || !parityBlocks) {
+        return -3;
+    }
+    return DecodeBlocks(params, dataBlocks, NULL, parityBlocks, erasures, num_erasures, NULL, 1);
+}
+
+int cauchy_rs_repair_sources(
+    cauchy_encoder_params params, // Encoder params
+    const uint8_t* available,
+    uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t* sources)
+{
+    uint8_t sorted[256], rows[256];
+    int n, ret;
+
+    ret = CheckDecodeParams(params, erasures, num_erasures);
+    if (ret) {
+        return ret;
+    }
+    if (!sources) {
+        return -3;
+    }
+
+    n = RepairRows(params, available, NULL, erasures, num_erasures, sorted, rows);
+    if (n <= 0) {
+        return n;
+    }
+
+    // The inputs of the decode decode_any() would run
+    InverseInputs(params, sorted, rows, n, sources);
+    return params.OriginalCount;
+}
+
+// Start loading the blocks a decode with the plan reads
+static void PrefetchDecodeStripe(const DecoderPlan* plan, cauchy_encoder_params params, const cauchy_stripe* stripe)
+{
+    const int blocks = params.OriginalCount;
+    int i, offset, bytes;
+
+    // The start of each block read, a quarter of L2 across the k survivors
+    // and parity, so it is still cached when the decode reaches it
+    bytes = (int)(CpuL2CacheBytes / 4 / blocks);
+    if (bytes > params.BlockBytes) {
+        bytes = params.BlockBytes;
+    }
+
+    for (offset = 0; offset < bytes; offset += CAUCHY_CACHE_LINE_BYTES) {
+        for (i = 0; i < blocks - plan->N; ++i) {
+            __builtin_prefetch(stripe->DataBlocks[plan->Originals[i]] + offset);
+        }
+        for (i = 0; i < plan->N; ++i) {
+            __builtin_prefetch(stripe->ParityBlocks[plan->RecoveryRows[i]] + offset);
+        }
+    }
+}
+
+int cauchy_rs_decode_batch(
+    cauchy_encoder_params params, // Encoder params
+    cauchy_stripe* stripes,       // Stripes to decode
+    int stripeCount,              // Number of stripes
+    uint8_t* erasures,            // Erasures shared by every stripe
+    uint8_t num_erasures)         // the number of erasures
+{
+    DecoderPlan* plan;
+    InversePlan* inverse;
+    uint8_t** dataBlocks;
+    uint8_t sorted[256], rows[256];
+    int stripe, n, i, ret = 0;
+
+    if (stripeCount < 0) {
+        return -1;
+    }
+    if (!stripes) {
+        return -3;
+    }
+    for (stripe = 0; stripe < stripeCount; ++stripe) {
+        if (!stripes[stripe].DataBlocks || !stripes[stripe].ParityBlocks) {
+            return -3;
+        }
+    }
+
+    // Nothing to share between stripes for these
+    if (params.Code != CAUCHY_CODE_CAUCHY || params.RecoveryCount == 1 || num_erasures == 0) {
+        for (stripe = 0; stripe < stripeCount; ++stripe) {
+            ret = cauchy_rs_decode(params, stripes[stripe].DataBlocks, stripes[stripe].ParityBlocks,
+                erasures, num_erasures);
+            if (ret) {
+                return ret;
+            }
+        }
+        return 0;
+    }
+
+    ret = CheckDecodeParams(params, erasures, num_erasures);
+    if (ret) {
+        return ret;
+    }
+
+    n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    if (n < 0) {
+        return -1;
+    }
+
+    // The same decoder DecodeSorted() would pick, chosen once for the batch
+    if (n == 1 && rows[0] == 0) {
+        for (stripe = 0; stripe < stripeCount; ++stripe) {
+            dataBlocks = stripes[stripe].DataBlocks;
+            DecodeOneXor(params, dataBlocks, NULL, stripes[stripe].ParityBlocks[0], sorted[0],
+                dataBlocks[sorted[0]]);
+        }
+        return 0;
+    }
+
+    if (n <= 2) {
+        inverse = InversePlanCreate(params, sorted, rows, n, NULL);
+        if (!inverse) {
+            return -3;
+        }
+        for (stripe = 0; stripe < stripeCount; ++stripe) {
+            dataBlocks = stripes[stripe].DataBlocks;
+            InversePlanBlocks(params, inverse, dataBlocks, stripes[stripe].ParityBlocks);
+            for (i = 0; i < n; ++i) {
+                inverse->Outputs[i] = dataBlocks[sorted[i]];
+            }
+            InverseApply(params, inverse, params.BlockBytes);
+        }
+        kfree(inverse);
+        return 0;
+    }
+
+    // One plan for the whole batch
+    plan = DecoderPlanGet(params, n, sorted, rows);
+    if (!plan) {
+        return -3;
+    }
+
+    for (stripe = 0; stripe < stripeCount && !ret; ++stripe) {
+        if (stripe + 1 < stripeCount) {
+            PrefetchDecodeStripe(plan, params, &stripes[stripe + 1]);
+        }
+
+        ret = DecodeStripe(plan, params, stripes[stripe].DataBlocks, NULL, stripes[stripe].ParityBlocks, NULL);
+    }
+
+    DecoderPlanPut(plan);
+    return ret;
+}
+
+
+//-----------------------------------------------------------------------------
+// XOR Schedule
+
+static FORCE_INLINE int BitCount64(uint64_t v)
+{
+    int bits = 0;
+
+    for (; v; v &= v - 1) {
+        ++bits;
+    }
+    return bits;
+}
+
+// Inverts the n x n matrix in place of inverse by Gauss-Jordan elimination.
+// The input matrix is destroyed.  Returns nonzero if it is singular.
+static int InvertMatrix(uint8_t* matrix, uint8_t* inverse, int n)
+{
+    int row, col, pivot, j;
+    uint8_t t, scale;
+
+    memset(inverse, 0, n * n);
+    for (row = 0; row < n; ++row) {
+        inverse[row * n + row] = 1;
+    }
+
+    for (col = 0; col < n; ++col) {
+        for (pivot = col; pivot < n && !matrix[pivot * n + col]; ++pivot);
+        if (pivot >= n) {
+            return -1;
+        }
+        if (pivot != col) {
+            for (j = 0; j < n; ++j) {
+                t = matrix[col * n + j];
+                matrix[col * n + j] = matrix[pivot * n + j];
+                matrix[pivot * n + j] = t;
+                t = inverse[col * n + j];
+                inverse[col * n + j] = inverse[pivot * n + j];
+                inverse[pivot * n + j] = t;
+            }
+        }
+
+        scale = gf_inv(matrix[col * n + col]);
+        for (j = 0; j < n; ++j) {
+            matrix[col * n + j] = gf_mul(matrix[col * n + j], scale);
+            inverse[col * n + j] = gf_mul(inverse[col * n + j], scale);
+        }
+
+        for (row = 0; row < n; ++row) {
+            scale = matrix[row * n + col];
+            if (row == col || !scale) {
+                continue;
+            }
+            for (j = 0; j < n; ++j) {
+                matrix[row * n + j] ^= gf_mul(matrix[col * n + j], scale);
+                inverse[row * n + j] ^= gf_mul(inverse[col * n + j], scale);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+    Each outputCount x inputCount GF(256) element is expanded to the 8x8 bit
+    matrix of multiplication by it, so output packet i of a block is the XOR
+    of the input packets selected by one row of the full bit matrix.
+
+    Rows are then scheduled greedily: the next row computed is the one that
+    needs the fewest source packets, either on its own or as a copy of a row
+    already computed plus the packets where the two rows differ.  This finds
+    the sharing between rows that a plain row-by-row XOR would repeat.
+*/
+static cauchy_xor_schedule* BuildXorSchedule(
+    cauchy_encoder_params params, // Parameters the schedule is used with
+    const uint8_t* matrix,        // outputCount x inputCount, row-major
+    int outputCount,              // Output blocks
+    int inputCount)               // Input blocks
+{
+    const int rowCount = outputCount * CAUCHY_XOR_PACKETS;
+    const int width = inputCount * CAUCHY_XOR_PACKETS;
+    const int words = (width + 63) / 64;
+    cauchy_xor_schedule* schedule = NULL;
+    uint64_t *bits, *row, *other;
+    int *cost, *from, *order, *sourceStart;
+    uint16_t *sources;
+    uint8_t *done, a_ij, product;
+    int total = 0, step, best, r, u, i, j, b, w, n;
+
+    bits = cauchy_malloc(sizeof(uint64_t) * rowCount * words + sizeof(int) * rowCount * 3 + rowCount);
+    if (!bits) {
+        return NULL;
+    }
+    cost = (int*)(bits + rowCount * words);
+    from = cost + rowCount;
+    order = from + rowCount;
+    done = (uint8_t*)(order + rowCount);
+    memset(bits, 0, sizeof(uint64_t) * rowCount * words);
+    memset(done, 0, rowCount);
+
+    // Column b of the bit matrix for a_ij is a_ij * 2^b
+    for (i = 0; i < outputCount; ++i) {
+        for (j = 0; j < inputCount; ++j) {
+            a_ij = matrix[i * inputCount + j];
+            for (b = 0; b < CAUCHY_XOR_PACKETS; ++b) {
+                product = gf_mul(a_ij, (uint8_t)(1 << b));
+                for (r = 0; r < CAUCHY_XOR_PACKETS; ++r) {
+                    if (product & (1 << r)) {
+                        n = j * CAUCHY_XOR_PACKETS + b;
+                        bits[(i * CAUCHY_XOR_PACKETS + r) * words + n / 64] |= (uint64_t)1 << (n % 64);
+                    }
+                }
+            }
+        }
+    }
+
+    for (r = 0; r < rowCount; ++r) {
+        cost[r] = 0;
+        for (w = 0; w < words; ++w) {
+            cost[r] += BitCount64(bits[r * words + w]);
+        }
+        from[r] = -1;
+    }
+
+    for (step = 0; step < rowCount; ++step) {
+        best = -1;
+        for (r = 0; r < rowCount; ++r) {
+            if (!done[r] && (best < 0 || cost[r] < cost[best])) {
+                best = r;
+            }
+        }
+        done[best] = 1;
+        order[step] = best;
+        total += cost[best];
+
+        // Rows left may now be cheaper as a copy of this one
+        row = bits + best * words;
+        for (u = 0; u < rowCount; ++u) {
+            if (done[u]) {
+                continue;
+            }
+            other = bits + u * words;
+            n = 1;
+            for (w = 0; w < words && n < cost[u]; ++w) {
+                n += BitCount64(row[w] ^ other[w]);
+            }
+            if (n < cost[u]) {
+                cost[u] = n;
+                from[u] = best;
+            }
+        }
+    }
+
+    schedule = cauchy_malloc(sizeof(cauchy_xor_schedule) + sizeof(int) * (rowCount + 1)
+        + sizeof(uint16_t) * (rowCount + total));
+    if (!schedule) {
+        goto done;
+    }
+    schedule->Params = params;
+    schedule->InputCount = inputCount;
+    schedule->OutputCount = outputCount;
+    schedule->XorCount = 0;
+    schedule->SourceStart = sourceStart = (int*)(schedule + 1);
+    schedule->Order = (uint16_t*)(sourceStart + rowCount + 1);
+    schedule->Sources = sources = schedule->Order + rowCount;
+
+    n = 0;
+    for (step = 0; step < rowCount; ++step) {
+        r = order[step];
+        schedule->Order[step] = (uint16_t)(r);
+        sourceStart[step] = n;
+
+        row = bits + r * words;
+        other = NULL;
+        if (from[r] >= 0) {
+            sources[n++] = (uint16_t)(width + from[r]);
+            other = bits + from[r] * words;
+        }
+        for (w = 0; w < words; ++w) {
+            uint64_t v = other ? (row[w] ^ other[w]) : row[w];
+            for (; v; v &= v - 1) {
+                for (b = 0; !(v & ((uint64_t)1 << b)); ++b);
+                sources[n++] = (uint16_t)(w * 64 + b);
+            }
+        }
+        if (n - sourceStart[step] > 1) {
+            schedule->XorCount += n - sourceStart[step] - 1;
+        }
+    }
+    sourceStart[rowCount] = n;
+
+done:
+    kfree(bits);
+    return schedule;
+}
+
+// Source packet of a schedule step, an input packet or an output one computed earlier
+static FORCE_INLINE const uint8_t* XorSource(
+    const cauchy_xor_schedule* schedule,
+    uint8_t** inputs,
+    uint8_t** outputs,
+    int source,
+    int packetBytes,
+    int offset)
+{
+    const int width = schedule->InputCount * CAUCHY_XOR_PACKETS;
+
+    if (source >= width) {
+        source -= width;
+        return outputs[source / CAUCHY_XOR_PACKETS] + (source % CAUCHY_XOR_PACKETS) * packetBytes + offset;
+    }
+    return inputs[source / CAUCHY_XOR_PACKETS] + (source % CAUCHY_XOR_PACKETS) * packetBytes + offset;
+}
+
+// Runs the schedule over bytes [offset, offset + bytes) of every packet
+static void RunXorSchedule(
+    const cauchy_xor_schedule* schedule,
+    uint8_t** inputs,
+    uint8_t** outputs,
+    int packetBytes,
+    int offset,
+    int bytes)
+{
+    const int rowCount = schedule->OutputCount * CAUCHY_XOR_PACKETS;
+    const uint16_t* sources;
+    uint8_t* out;
+    int step, r, n, s;
+
+    for (step = 0; step < rowCount; ++step) {
+        r = schedule->Order[step];
+        out = outputs[r / CAUCHY_XOR_PACKETS] + (r % CAUCHY_XOR_PACKETS) * packetBytes + offset;
+        sources = schedule->Sources + schedule->SourceStart[step];
+        n = schedule->SourceStart[step + 1] - schedule->SourceStart[step];
+
+        if (n == 0) {
+            memset(out, 0, bytes);
+            continue;
+        }
+        if (n == 1) {
+            memcpy(out, XorSource(schedule, inputs, outputs, sources[0], packetBytes, offset), bytes);
+            continue;
+        }
+
+        gf_addset_mem(out,
+            XorSource(schedule, inputs, outputs, sources[0], packetBytes, offset),
+            XorSource(schedule, inputs, outputs, sources[1], packetBytes, offset), bytes);
+        for (s = 2; s + 1 < n; s += 2) {
+            gf_add2_mem(out,
+                XorSource(schedule, inputs, outputs, sources[s], packetBytes, offset),
+                XorSource(schedule, inputs, outputs, sources[s + 1], packetBytes, offset), bytes);
+        }
+        if (s < n) {
+            gf_add_mem(out, XorSource(schedule, inputs, outputs, sources[s], packetBytes, offset), bytes);
+        }
+    }
+}
+
+// Runs the schedule a tile at a time so the inputs stay in cache across rows
+static void ApplyXorSchedule(
+    const cauchy_xor_schedule* schedule,
+    uint8_t** inputs,
+    uint8_t** outputs)
+{
+    const int packetBytes = schedule->Params.BlockBytes / CAUCHY_XOR_PACKETS;
+    int tileBytes, offset, bytes;
+
+    tileBytes = (cauchy_get_tile_bytes(schedule->Params) / CAUCHY_XOR_PACKETS) & ~(GF_ALIGN_BYTES - 1);
+    if (tileBytes < GF_ALIGN_BYTES) {
+        tileBytes = GF_ALIGN_BYTES;
+    }
+
+    for (offset = 0; offset < packetBytes; offset += tileBytes) {
+        bytes = packetBytes - offset;
+        if (bytes > tileBytes) {
+            bytes = tileBytes;
+        }
+        RunXorSchedule(schedule, inputs, outputs, packetBytes, offset, bytes);
+    }
+}
+
+static int CheckXorParams(cauchy_encoder_params params)
+{
+    int ret;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (params.BlockBytes % (CAUCHY_XOR_PACKETS * GF_ALIGN_BYTES)) {
+        return -1;
+    }
+    return 0;
+}
+
+cauchy_xor_schedule* cauchy_rs_xor_schedule_create(cauchy_encoder_params params)
+{
+    cauchy_xor_schedule* schedule;
+    uint8_t* matrix;
+    int row, col;
+
+    if (CheckXorParams(params)) {
+        return NULL;
+    }
+
+    matrix = cauchy_malloc(params.RecoveryCount * params.OriginalCount);
+    if (!matrix) {
+        return NULL;
+    }
+    for (row = 0; row < params.RecoveryCount; ++row) {
+        for (col = 0; col < params.OriginalCount; ++col) {
+            matrix[row * params.OriginalCount + col] = GetEncodeElement(params, row, col);
+        }
+    }
+
+    schedule = BuildXorSchedule(params, matrix, params.RecoveryCount, params.OriginalCount);
+    kfree(matrix);
+    return schedule;
+}
+
+void cauchy_rs_xor_schedule_free(cauchy_xor_schedule* schedule)
+{
+    kfree(schedule);
+}
+
+int cauchy_rs_encode_xor(
+    const cauchy_xor_schedule* schedule, // Schedule for the encoder parameters
+    uint8_t** dataBlocks,                // Array of pointers to original blocks
+    uint8_t** parityBlocks)              // Array of pointers to output parity blocks
+{
+    if (!schedule || !dataBlocks || !parityBlocks) {
+        return -3;
+    }
+
+    ApplyXorSchedule(schedule, dataBlocks, parityBlocks);
+    return 0;
+}
+
+/*
+    With E the erased columns and S the surviving ones, the first |E| parity
+    rows give A_E * D_E = P + A_S * D_S, so D_E = A_E^-1 * (P + A_S * D_S).
+    That is one matrix product over the surviving originals and the parity,
+    which is run through a schedule built for this erasure pattern.
+*/
+int cauchy_rs_decode_xor(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures)
+{
+    const int k = params.OriginalCount;
+    cauchy_xor_schedule* schedule = NULL;
+    uint8_t *matrix, *inverse, *decodeMatrix, erased[256];
+    uint8_t **inputs, **outputs, sum;
+    int ret, i, j, e, s;
+
+    ret = CheckXorParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (!dataBlocks || !parityBlocks || (num_erasures && !erasures)) {
+        return -3;
+    }
+    if (num_erasures > params.RecoveryCount) {
+        return -1;
+    }
+    memset(erased, 0, k);
+    for (i = 0; i < num_erasures; i++) {
+        if (erasures[i] >= k || erased[erasures[i]]) {
+            return -1;
+        }
+        erased[erasures[i]] = 1;
+    }
+    if (num_erasures == 0) {
+        return 0;
+    }
+
+    // Block pointers first to keep them aligned, then the square submatrix,
+    // its inverse and the decode matrix
+    inputs = cauchy_malloc(sizeof(uint8_t*) * (k + num_erasures)
+        + num_erasures * num_erasures * 2 + num_erasures * k);
+    if (!inputs) {
+        return -3;
+    }
+    outputs = inputs + k;
+    matrix = (uint8_t*)(outputs + num_erasures);
+    inverse = matrix + num_erasures * num_erasures;
+    decodeMatrix = inverse + num_erasures * num_erasures;
+
+    for (i = 0; i < num_erasures; ++i) {
+        for (e = 0; e < num_erasures; ++e) {
+            matrix[i * num_erasures + e] = GetEncodeElement(params, i, erasures[e]);
+        }
+    }
+    if (InvertMatrix(matrix, inverse, num_erasures)) {
+        ret = -1;
+        goto done;
+    }
+
+    // Inputs are the surviving originals in order, then the parity blocks
+    for (e = 0; e < num_erasures; ++e) {
+        s = 0;
+        for (j = 0; j < k; ++j) {
+            if (erased[j]) {
+                continue;
+            }
+            sum = 0;
+            for (i = 0; i < num_erasures; ++i) {
+                sum ^= gf_mul(inverse[e * num_erasures + i], GetEncodeElement(params, i, j));
+            }
+            decodeMatrix[e * k + s] = sum;
+            if (e == 0) {
+                inputs[s] = dataBlocks[j];
+            }
+            ++s;
+        }
+        for (i = 0; i < num_erasures; ++i) {
+            decodeMatrix[e * k + s + i] = inverse[e * num_erasures + i];
+            if (e == 0) {
+                inputs[s + i] = parityBlocks[i];
+            }
+        }
+        outputs[e] = dataBlocks[erasures[e]];
+    }
+
+    schedule = BuildXorSchedule(params, decodeMatrix, num_erasures, k);
+    if (!schedule) {
+        ret = -3;
+        goto done;
+    }
+    ApplyXorSchedule(schedule, inputs, outputs);
 
-    // Recovery blocks
-    cauchy_block* Recovery[256];
-    int RecoveryCount;
+done:
+    kfree(schedule);
+    kfree(inputs);
+    return ret;
+}
 
-    // Original blocks
-    cauchy_block* Original[256];
-    int OriginalCount;
 
-    // Row indices that were erased
-    uint8_t ErasuresIndices[256];
+//-----------------------------------------------------------------------------
+// Inverse Decoding
+
+/*
+    With E the erased originals, S the survivors and R the parity rows used,
+    A_RE * D_E = P_R + A_RS * D_S.  Inverting the small matrix A_RE gives
+    every erased original directly as a combination of the k blocks read:
 
-}CauchyDecoder;
+        D_E = A_RE^-1 * P_R + (A_RE^-1 * A_RS) * D_S
 
-int Initialize(CauchyDecoder *decoder, cauchy_encoder_params params, cauchy_block* blocks) {
-    int ii, row, indexCount;
-    cauchy_block* block = blocks;
-    decoder->Params = params;
+    so each one is computed in a single pass over the inputs, and none of
+    them depends on another as the rows of the LDU decoder do.
+*/
 
-    decoder->OriginalCount = 0;
-    decoder->RecoveryCount = 0;
+// Outputs computed together in one pass over the inputs
+#define CAUCHY_DOT_OUTPUTS 4
 
-    // Initialize erasures to zeros
-    for (ii = 0; ii < params.OriginalCount; ++ii){
-        decoder->ErasuresIndices[ii] = 0;
-    }
+#if defined(GF_AVX2)
+static FORCE_INLINE void DotProduct256(
+    uint8_t** out,                // Output blocks
+    const int outCount,           // Number of outputs, a constant
+    const gf_mul_table* tables,   // outCount x inCount coefficients, row-major
+    uint8_t** in,                 // Input blocks
+    int inCount,                  // Number of inputs
+    int offset,                   // First byte
+    int end)                      // Byte after the last, a multiple of 32 from offset
+{
+    M256 acc[CAUCHY_DOT_OUTPUTS], clr_mask, x0, l0, h0, p0;
+    int i, j, r;
 
-    // For each input block,
-    for (ii = 0; ii < params.OriginalCount; ++ii, ++block){
-        row = block->Index;
+    clr_mask = vector_set_256(0x0f);
 
-        // If it is an original block,
-        if (row < params.OriginalCount){
-            decoder->Original[decoder->OriginalCount++] = block;
-            if (decoder->ErasuresIndices[row] != 0){
-                // Error out if two row indices repeat
-                printk(KERN_INFO "Indices incorrect\n");
-                return -1;
+    for (i = offset; i < end; i += 32) {
+        for (r = 0; r < outCount; ++r) {
+            acc[r] = vector_xor_256(clr_mask, clr_mask);
+        }
+        for (j = 0; j < inCount; ++j) {
+            x0 = *(const M256*)(in[j] + i);
+            l0 = vector_and_256(x0, clr_mask);
+            h0 = vector_and_256(vector_srli_epi64_256(x0, 4), clr_mask);
+            for (r = 0; r < outCount; ++r) {
+                p0 = vector_xor_256(
+                    vector_shuffle_epi8_256(*tables[r * inCount + j].Lo256, l0),
+                    vector_shuffle_epi8_256(*tables[r * inCount + j].Hi256, h0));
+                acc[r] = vector_xor_256(acc[r], p0);
             }
-            decoder->ErasuresIndices[row] = 1;
         }
-        else{
-            decoder->Recovery[decoder->RecoveryCount++] = block;
+        for (r = 0; r < outCount; ++r) {
+            *(M256*)(out[r] + i) = acc[r];
         }
     }
+}
+#endif // GF_AVX2
 
-    // Identify erasures
-    for (ii = 0, indexCount = 0; ii < 256; ++ii) {
-        if (!decoder->ErasuresIndices[ii]) {
-            decoder->ErasuresIndices[indexCount] = (uint8_t)( ii );
+// out[r] = sum(tables[r * inCount + j] * in[j]) over bytes [offset, offset + bytes)
+// for up to CAUCHY_DOT_OUTPUTS outputs, reading each input once
+static void DotProductMem(
+    uint8_t** out,                // Output blocks
+    int outCount,                 // Number of outputs
+    const gf_mul_table* tables,   // outCount x inCount coefficients, row-major
+    uint8_t** in,                 // Input blocks
+    int inCount,                  // Number of inputs
+    int offset,                   // First byte
+    int bytes)                    // Bytes to compute
+{
+    int i, j, r, end;
+    uint8_t sum;
 
-            if (++indexCount >= decoder->RecoveryCount) {
-                break;
+#if defined(GF_AVX2)
+    if (CpuHasAVX2) {
+        end = offset + (bytes & ~31);
+
+        // Constant output counts keep the accumulators in registers
+        kernel_fpu_begin();
+        switch (outCount) {
+        case 1: DotProduct256(out, 1, tables, in, inCount, offset, end); break;
+        case 2: DotProduct256(out, 2, tables, in, inCount, offset, end); break;
+        case 3: DotProduct256(out, 3, tables, in, inCount, offset, end); break;
+        default: DotProduct256(out, 4, tables, in, inCount, offset, end); break;
+        }
+        kernel_fpu_end();
+
+        // Remaining bytes one at a time
+        for (i = end; i < offset + bytes; ++i) {
+            for (r = 0; r < outCount; ++r) {
+                sum = 0;
+                for (j = 0; j < inCount; ++j) {
+                    sum ^= tables[r * inCount + j].Scalar[in[j][i]];
+                }
+                out[r][i] = sum;
             }
         }
+        return;
+    }
+#endif // GF_AVX2
+
+    for (r = 0; r < outCount; ++r) {
+        gf_mul_mem_table(out[r] + offset, in[0] + offset, &tables[r * inCount], bytes);
+        for (j = 1; j < inCount; ++j) {
+            gf_muladd_mem_table(out[r] + offset, &tables[r * inCount + j], in[j] + offset, bytes);
+        }
     }
-    return 0;
 }
 
-void DecodeM1(CauchyDecoder *decoder){
-    // XOR all other blocks into the recovery block
-    uint8_t* outBlock = (uint8_t*)(decoder->Recovery[0]->Block);
-    uint8_t* inBlock = NULL;
-    int ii;
-    uint8_t* inBlock2;
+// Inverts the matrix of the erased originals against the parity rows used.
+// Takes n * n bytes of scratch.  Returns 0, or -1 if singular.
+static int InvertErasures(
+    cauchy_encoder_params params,
+    const uint8_t* sorted,
+    const uint8_t* rows,
+    int n,
+    uint8_t* matrix,
+    uint8_t* inverse)
+{
+    int i, e;
+
+    for (i = 0; i < n; ++i) {
+        for (e = 0; e < n; ++e) {
+            matrix[i * n + e] = GetEncodeElement(params, rows[i], sorted[e]);
+        }
+    }
+    return InvertMatrix(matrix, inverse, n);
+}
 
-    // For each block,
-    for (ii = 0; ii < decoder->OriginalCount; ++ii) {
-        inBlock2 = (uint8_t*)(decoder->Original[ii]->Block);
+// Block indices of the inputs an inverse decode reads, as by
+// cauchy_get_original_block_index() and cauchy_get_recovery_block_index():
+// the surviving originals in order, then the parity rows used.  There are
+// OriginalCount of them.
+static void InverseInputs(
+    cauchy_encoder_params params,
+    const uint8_t* sorted,
+    const uint8_t* rows,
+    int n,
+    uint8_t* order)
+{
+    int i, j, e;
 
-        if (!inBlock) {
-            inBlock = inBlock2;
-        }else {
-            // outBlock ^= inBlock ^ inBlock2
-            gf_add2_mem(outBlock, inBlock, inBlock2, decoder->Params.BlockBytes);
-            inBlock = NULL;
+    for (j = 0, e = 0, i = 0; j < params.OriginalCount; ++j) {
+        if (e < n && sorted[e] == j) {
+            ++e;
+        } else {
+            order[i++] = cauchy_get_original_block_index(params, j);
         }
     }
+    for (e = 0; e < n; ++e) {
+        order[i + e] = cauchy_get_recovery_block_index(params, rows[e]);
+    }
+}
 
-    // Complete XORs
-    if (inBlock) {
-        gf_add_mem(outBlock, inBlock, decoder->Params.BlockBytes);
+// Block pointer for an index from InverseInputs()
+static FORCE_INLINE uint8_t* InverseInputBlock(cauchy_encoder_params params, uint8_t** dataBlocks,
+    uint8_t** parityBlocks, int index)
+{
+    if (index < params.OriginalCount) {
+        return dataBlocks[index];
     }
+    return parityBlocks[index - params.OriginalCount];
+}
 
-    // Recover the index it corresponds to
-    decoder->Recovery[0]->Index = decoder->ErasuresIndices[0];
+// Coefficients of erased original e from its row of the inverse, for the
+// inputs in the order of InverseInputs()
+static void InverseRow(
+    cauchy_encoder_params params,
+    const uint8_t* order,
+    const uint8_t* rows,
+    int n,
+    const uint8_t* inverse,
+    int e,
+    uint8_t* coef)
+{
+    const int survivors = params.OriginalCount - n;
+    uint8_t a_ij;
+    int i, s;
+
+    for (s = 0; s < survivors; ++s) {
+        a_ij = 0;
+        for (i = 0; i < n; ++i) {
+            a_ij ^= gf_mul(inverse[e * n + i], GetEncodeElement(params, rows[i], order[s]));
+        }
+        coef[s] = a_ij;
+    }
+    for (i = 0; i < n; ++i) {
+        coef[survivors + i] = inverse[e * n + i];
+    }
 }
 
-// Generate the LU decomposition of the matrix
-void GenerateLDUDecomposition(CauchyDecoder *decoder, uint8_t* matrix_L, uint8_t* diag_D, uint8_t* matrix_U) {
-    // Schur-type-direct-Cauchy algorithm 2.5 from
-    // "Pivoting and Backward Stability of Fast Algorithms for Solving Cauchy Linear Equations"
-    // T. Boros, T. Kailath, V. Olshevsky
-    // Modified for practical use.  I folded the diagonal parts of U/L matrices into the
-    // diagonal one to reduce the number of multiplications to perform against the input data,
-    // and organized the triangle matrices in memory to allow for faster SSE3 GF multiplications.
+// Builds the plan for each erasure e whose outputs[rows[e]] is not NULL, or
+// for every erasure if outputs is NULL.  Returns NULL if the matrix is
+// singular or allocation fails.
+static InversePlan* InversePlanCreate(
+    cauchy_encoder_params params,
+    const uint8_t* sorted,
+    const uint8_t* rows,
+    int n,
+    uint8_t** outputs)
+{
+    const int k = params.OriginalCount;
+    InversePlan* plan;
+    uint8_t *matrix, *inverse, *coef;
+    int e, j, w;
+
+    // Plan, tables, block pointers, then the small matrix, its inverse and a
+    // row of coefficients
+    plan = cauchy_malloc(sizeof(InversePlan) + sizeof(gf_mul_table) * n * k + sizeof(uint8_t*) * (k + n) +
+        n * n * 2 + k);
+    if (!plan) {
+        return NULL;
+    }
+    plan->Tables = (gf_mul_table*)(plan + 1);
+    plan->Inputs = (uint8_t**)(plan->Tables + n * k);
+    plan->Outputs = plan->Inputs + k;
+    matrix = (uint8_t*)(plan->Outputs + n);
+    inverse = matrix + n * n;
+    coef = inverse + n * n;
+
+    if (n > 0 && InvertErasures(params, sorted, rows, n, matrix, inverse)) {
+        kfree(plan);
+        return NULL;
+    }
 
-    // Matrix size NxN
-    int N = decoder->RecoveryCount;
-    int count;
-    int i, firstOffset_U, j, k;
-    uint8_t rotated_row_U[256];
-    uint8_t *last_U, *row_L, *row_U, *output_U;
-    uint8_t x_0, x_k, y_k, D_kk, L_kk, U_kk, x_j, y_j, L_jk, U_kj, x_n, y_n, L_nn, U_nn;
+    InverseInputs(params, sorted, rows, n, plan->Order);
+    for (e = 0, w = 0; e < n; ++e) {
+        if (outputs && !outputs[rows[e]]) {
+            continue;
+        }
+        InverseRow(params, plan->Order, rows, n, inverse, e, coef);
+        for (j = 0; j < k; ++j) {
+            gf_mul_table_init(&plan->Tables[w * k + j], coef[j]);
+        }
+        ++w;
+    }
+    plan->Count = w;
 
-    // Generators
-    uint8_t g[256], b[256];
-    for (i = 0; i < N; ++i) {
-        g[i] = 1;
-        b[i] = 1;
+    return plan;
+}
+
+// Points the plan's inputs at one stripe's blocks
+static void InversePlanBlocks(cauchy_encoder_params params, InversePlan* plan, uint8_t** dataBlocks,
+    uint8_t** parityBlocks)
+{
+    int i;
+
+    for (i = 0; i < params.OriginalCount; ++i) {
+        plan->Inputs[i] = InverseInputBlock(params, dataBlocks, parityBlocks, plan->Order[i]);
     }
+}
 
-    // Temporary buffer for rotated row of U matrix
-    // This allows for faster GF bulk multiplication
-    last_U = matrix_U + ((N - 1) * N) / 2 - 1;
-    firstOffset_U = 0;
+// Computes the plan's outputs from its inputs, every output for a slice
+// while its inputs are in cache
+static void InverseApply(cauchy_encoder_params params, const InversePlan* plan, int blockBytes)
+{
+    const int k = params.OriginalCount;
+    const int tileBytes = cauchy_get_tile_bytes(params);
+    int offset, bytes, e;
+
+    for (offset = 0; offset < blockBytes; offset += tileBytes) {
+        bytes = blockBytes - offset;
+        if (bytes > tileBytes) {
+            bytes = tileBytes;
+        }
+        for (e = 0; e < plan->Count; e += CAUCHY_DOT_OUTPUTS) {
+            DotProductMem(plan->Outputs + e, plan->Count - e < CAUCHY_DOT_OUTPUTS ? plan->Count - e : CAUCHY_DOT_OUTPUTS,
+                plan->Tables + e * k, plan->Inputs, k, offset, bytes);
+        }
+    }
+}
 
-    // Start the x_0 values arbitrarily from the original count.
-    x_0 = (uint8_t)(decoder->Params.OriginalCount);
+// Decode sorted erasures with the parity rows given for them, writing
+// sorted[e] to outBlocks[rows[e]], or straight into dataBlocks if outBlocks
+// is NULL.  Outputs that are NULL are not computed.
+// Returns 0, or -3 if the plan cannot be built.
+static int InverseDecode(
+    cauchy_encoder_params params,
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    const uint8_t* sorted,
+    const uint8_t* rows,
+    int n,
+    uint8_t** outBlocks)
+{
+    InversePlan* plan;
+    int e, w;
 
-    // Unrolling k = 0 just makes it slower for some reason.
-    for (k = 0; k < N - 1; ++k) {
-        x_k = decoder->Recovery[k]->Index;
-        y_k = decoder->ErasuresIndices[k];
+    plan = InversePlanCreate(params, sorted, rows, n, outBlocks);
+    if (!plan) {
+        return -3;
+    }
 
-        // D_kk = (x_k + y_k)
-        // L_kk = g[k] / (x_k + y_k)
-        // U_kk = b[k] * (x_0 + y_k) / (x_k + y_k)
-        D_kk = gf_add(x_k, y_k);
-        L_kk = gf_div(g[k], D_kk);
-        U_kk = gf_mul(gf_div(b[k], D_kk), gf_add(x_0, y_k));
+    InversePlanBlocks(params, plan, dataBlocks, parityBlocks);
+    for (e = 0, w = 0; e < n; ++e) {
+        if (!outBlocks) {
+            plan->Outputs[w++] = dataBlocks[sorted[e]];
+        } else if (outBlocks[rows[e]]) {
+            plan->Outputs[w++] = outBlocks[rows[e]];
+        }
+    }
 
-        // diag_D[k] = D_kk * L_kk * U_kk
-        diag_D[k] = gf_mul(D_kk, gf_mul(L_kk, U_kk));
+    InverseApply(params, plan, params.BlockBytes);
 
-        // Computing the k-th row of L and U
-        row_L = matrix_L;
-        row_U = rotated_row_U;
-        for (j = k + 1; j < N; ++j) {
-            x_j = decoder->Recovery[j]->Index;
-            y_j = decoder->ErasuresIndices[j];
+    kfree(plan);
+    return 0;
+}
 
-            // L_jk = g[j] / (x_j + y_k)
-            // U_kj = b[j] / (x_k + y_j)
-            L_jk = gf_div(g[j], gf_add(x_j, y_k));
-            U_kj = gf_div(b[j], gf_add(x_k, y_j));
+int cauchy_rs_decode_inverse(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t** dataBlocks,
+    uint8_t** parityBlocks,
+    uint8_t* erasures,
+    uint8_t num_erasures)
+{
+    uint8_t sorted[256], rows[256];
+    int n, ret;
 
-            *matrix_L++ = L_jk;
-            *row_U++ = U_kj;
+    ret = CheckDecodeParams(params, erasures, num_erasures);
+    if (ret) {
+        return ret;
+    }
+    if (num_erasures == 0) {
+        return 0;
+    }
 
-            // g[j] = g[j] * (x_j + x_k) / (x_j + y_k)
-            // b[j] = b[j] * (y_j + y_k) / (y_j + x_k)
-            g[j] = gf_mul(g[j], gf_div(gf_add(x_j, x_k), gf_add(x_j, y_k)));
-            b[j] = gf_mul(b[j], gf_div(gf_add(y_j, y_k), gf_add(y_j, x_k)));
-        }
+    n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    if (n < 0) {
+        return -1;
+    }
 
-        // Do these row/column divisions in bulk for speed.
-        // L_jk /= L_kk
-        // U_kj /= U_kk
-        count = N - (k + 1);
-        gf_div_mem(row_L, row_L, L_kk, count);
-        gf_div_mem(rotated_row_U, rotated_row_U, U_kk, count);
+    return InverseDecode(params, dataBlocks, parityBlocks, sorted, rows, n, NULL);
+}
 
-        // Copy U matrix row into place in memory.
-        output_U = last_U + firstOffset_U;
-        row_U = rotated_row_U;
-        for (j = k + 1; j < N; ++j) {
-            *output_U = *row_U++;
-            output_U -= j;
-        }
-        firstOffset_U -= k + 2;
+cauchy_decoder* cauchy_rs_decoder_create(
+    cauchy_encoder_params params, // Encoder params
+    uint8_t* erasures,
+    uint8_t num_erasures,
+    uint8_t** outBlocks)
+{
+    const int k = params.OriginalCount;
+    cauchy_decoder* decoder;
+    uint8_t sorted[256], rows[256];
+    uint8_t *matrix, *inverse, *coef, *order;
+    int n, e, i, j, w;
+
+    if (CheckDecodeParams(params, erasures, num_erasures) || !outBlocks) {
+        return NULL;
+    }
+    n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    if (n < 0) {
+        return NULL;
     }
 
-    // Multiply diagonal matrix into U
-    row_U = matrix_U;
-    for (j = N - 1; j > 0; --j) {
-        y_j = decoder->ErasuresIndices[j];
-        count = j;
+    // Decoder, then tables, then outputs, then scratch for the inversion
+    decoder = cauchy_malloc(sizeof(cauchy_decoder) + sizeof(gf_mul_table) * n * k +
+        sizeof(uint8_t*) * n + n * n * 2 + k * 2);
+    if (!decoder) {
+        return NULL;
+    }
+    decoder->Tables = (gf_mul_table*)(decoder + 1);
+    decoder->Outputs = (uint8_t**)(decoder->Tables + n * k);
+    matrix = (uint8_t*)(decoder->Outputs + n);
+    inverse = matrix + n * n;
+    coef = inverse + n * n;
+    order = coef + k;
+
+    if (n > 0 && InvertErasures(params, sorted, rows, n, matrix, inverse)) {
+        kfree(decoder);
+        return NULL;
+    }
 
-        gf_mul_mem(row_U, row_U, gf_add(x_0, y_j), count);
-        row_U += count;
+    decoder->Params = params;
+    decoder->Needed = k;
+
+    // Each block's coefficients are in the column of its input
+    InverseInputs(params, sorted, rows, n, order);
+    memset(decoder->Slot, 0xff, sizeof(decoder->Slot));
+    memset(decoder->Added, 0, sizeof(decoder->Added));
+    for (i = 0; i < k; ++i) {
+        decoder->Slot[order[i]] = (uint8_t)(i);
     }
 
-    x_n = decoder->Recovery[N - 1]->Index;
-    y_n = decoder->ErasuresIndices[N - 1];
+    // Unwanted outputs are dropped, their rows are never needed
+    for (e = 0, w = 0; e < n; ++e) {
+        if (!outBlocks[rows[e]]) {
+            continue;
+        }
+        decoder->Outputs[w] = outBlocks[rows[e]];
 
-    // D_nn = 1 / (x_n + y_n)
-    // L_nn = g[N-1]
-    // U_nn = b[N-1] * (x_0 + y_n)
-    L_nn = g[N - 1];
-    U_nn = gf_mul(b[N - 1], gf_add(x_0, y_n));
+        InverseRow(params, order, rows, n, inverse, e, coef);
+        for (j = 0; j < k; ++j) {
+            gf_mul_table_init(&decoder->Tables[w * k + j], coef[j]);
+        }
+        ++w;
+    }
+    decoder->OutputCount = w;
 
-    // diag_D[N-1] = L_nn * D_nn * U_nn
-    diag_D[N - 1] = gf_div(gf_mul(L_nn, U_nn), gf_add(x_n, y_n));
+    return decoder;
 }
 
-void Decode(CauchyDecoder *decoder) {
-    // Matrix size is NxN, where N is the number of recovery blocks used.
-    const int N = decoder->RecoveryCount;
-
-    // Start the x_0 values arbitrarily from the original count.
-    const uint8_t x_0 = (uint8_t)(decoder->Params.OriginalCount);
-
-    int originalIndex, recoveryIndex, j, i;
-    int requiredSpace;
-    uint8_t *inBlock, *outBlock, *dynamicMatrix, *matrix, *matrix_U, *diag_D, *matrix_L;
-    uint8_t inRow, x_i, y_j, matrixElement, c_ij;
-    static const int StackAllocSize = 2048;
-    uint8_t stackMatrix[StackAllocSize];
-    void *block_j;
-    void *block_i, *block;
-    // Eliminate original data from the the recovery rows
-    for (originalIndex = 0; originalIndex < decoder->OriginalCount; ++originalIndex) {
-        inBlock = (uint8_t*)(decoder->Original[originalIndex]->Block);
-        inRow = decoder->Original[originalIndex]->Index;
+int cauchy_rs_decoder_add(
+    cauchy_decoder* decoder,
+    int blockIndex,
+    const uint8_t* block)
+{
+    const int k = decoder->Params.OriginalCount;
+    const int tileBytes = cauchy_get_tile_bytes(decoder->Params);
+    const gf_mul_table* tables;
+    int offset, bytes, e, slot;
 
-        for (recoveryIndex = 0; recoveryIndex < N; ++recoveryIndex) {
-            outBlock = (uint8_t*)(decoder->Recovery[recoveryIndex]->Block);
-            x_i = decoder->Recovery[recoveryIndex]->Index;
-            y_j = inRow;
-            matrixElement = GetMatrixElement(x_i, x_0, y_j);
+    if (blockIndex < 0 || blockIndex >= decoder->Params.OriginalCount + decoder->Params.RecoveryCount) {
+        return -1;
+    }
+    slot = decoder->Slot[blockIndex];
+    if (slot == 0xff) {
+        return -1;
+    }
+    if (!block) {
+        return -3;
+    }
+    if (decoder->Added[blockIndex]) {
+        return -4;
+    }
 
-            gf_muladd_mem(outBlock, matrixElement, inBlock, decoder->Params.BlockBytes);
+    // The first block sets the outputs, the rest are added in; the block is
+    // read a slice at a time while the outputs are updated from it
+    tables = decoder->Tables + slot;
+    for (offset = 0; offset < decoder->Params.BlockBytes; offset += tileBytes) {
+        bytes = decoder->Params.BlockBytes - offset;
+        if (bytes > tileBytes) {
+            bytes = tileBytes;
+        }
+        for (e = 0; e < decoder->OutputCount; ++e) {
+            if (decoder->Needed == k) {
+                gf_mul_mem_table(decoder->Outputs[e] + offset, block + offset, &tables[e * k], bytes);
+            } else {
+                gf_muladd_mem_table(decoder->Outputs[e] + offset, &tables[e * k], block + offset, bytes);
+            }
         }
     }
 
-    // Allocate matrix
-    dynamicMatrix = NULL;
-    matrix = stackMatrix;
-    requiredSpace = N * N;
-    if (requiredSpace > StackAllocSize) {
-        dynamicMatrix = cauchy_malloc(requiredSpace);
-        matrix = dynamicMatrix;
-    }
+    decoder->Added[blockIndex] = 1;
+    return --decoder->Needed;
+}
 
-    /*
-        Compute matrix decomposition:
+void cauchy_rs_decoder_free(cauchy_decoder* decoder)
+{
+    kfree(decoder);
+}
 
-            G = L * D * U
 
-        L is lower-triangular, diagonal is all ones.
-        D is a diagonal matrix.
-        U is upper-triangular, diagonal is all ones.
-    */
-    matrix_U = matrix;
-    diag_D = matrix_U + (N - 1) * N / 2;
-    matrix_L = diag_D + N;
-    GenerateLDUDecomposition(decoder, matrix_L, diag_D, matrix_U);
+//-----------------------------------------------------------------------------
+// Page Arrays
 
-    /*
-        Eliminate lower left triangle.
-    */
-    // For each column,
-    for (j = 0; j < N - 1; ++j) {
-        block_j = decoder->Recovery[j]->Block;
+#if defined(__KERNEL__)
 
-        // For each row,
-        for (i = j + 1; i < N; ++i) {
-            block_i = decoder->Recovery[i]->Block;
-            c_ij = *matrix_L++; // Matrix elements are stored column-first, top-down.
+// kmap_local_page() arrived in 5.11, older kernels have the atomic variant
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+    #define kmap_local_page(page) kmap_atomic(page)
+    #define kunmap_local(addr) kunmap_atomic(addr)
+#endif
+
+// Highmem kernels have a small stack of local mappings per CPU
+#if defined(CONFIG_HIGHMEM)
+    #define CAUCHY_MAX_LOCAL_MAPS 16
+#else
+    #define CAUCHY_MAX_LOCAL_MAPS 512
+#endif
+
+// Page and offset within that page for byte pos of a block
+static FORCE_INLINE struct page* PageAt(const cauchy_page_block* block, int pos, unsigned* pageOffset)
+{
+    unsigned long byte = (unsigned long)block->Offset + pos;
+
+    *pageOffset = (unsigned)(byte & ~PAGE_MASK);
+    return block->Pages[byte >> PAGE_SHIFT];
+}
+
+// Bytes from pos to the end of the page that holds it
+static FORCE_INLINE int PageRemaining(const cauchy_page_block* block, int pos)
+{
+    return (int)(PAGE_SIZE - (((unsigned long)block->Offset + pos) & ~PAGE_MASK));
+}
+
+// Length of the run starting at pos that stays within one page of every
+// block in the list
+static int PageRun(const cauchy_page_block* blocks, int count, int pos, int run)
+{
+    int i, remaining;
 
-            gf_muladd_mem(block_i, c_ij, block_j, decoder->Params.BlockBytes);
+    for (i = 0; i < count; ++i) {
+        remaining = PageRemaining(&blocks[i], pos);
+        if (remaining < run) {
+            run = remaining;
         }
     }
+    return run;
+}
 
-    /*
-        Eliminate diagonal.
-    */
-    for (i = 0; i < N; ++i) {
-        block = decoder->Recovery[i]->Block;
+static int CheckPageBlocks(const cauchy_page_block* blocks, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (!blocks[i].Pages) {
+            return -3;
+        }
+        if (blocks[i].Offset >= PAGE_SIZE || (blocks[i].Offset & (GF_ALIGN_BYTES - 1))) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-        decoder->Recovery[i]->Index = decoder->ErasuresIndices[i];
+int cauchy_rs_encode_pages(
+    cauchy_encoder_params params,   // Encoder params
+    const cauchy_page_block* dataBlocks,
+    const cauchy_page_block* parityBlocks)
+{
+    const int k = params.OriginalCount;
+    gf_mul_table* tables;
+    uint8_t **dst, *src;
+    unsigned pageOffset;
+    int pos, run, block, first, group, count, j, ret;
+
+    ret = CheckParams(params);
+    if (ret) {
+        return ret;
+    }
+    if (!dataBlocks || !parityBlocks) {
+        return -3;
+    }
+    ret = CheckPageBlocks(dataBlocks, params.OriginalCount);
+    if (!ret) {
+        ret = CheckPageBlocks(parityBlocks, params.RecoveryCount);
+    }
+    if (ret) {
+        return ret;
+    }
 
-        gf_div_mem(block, block, diag_D[i], decoder->Params.BlockBytes);
+    // Multiply tables and output pointers are set up before anything is
+    // mapped, since the mappings may be atomic
+    tables = cauchy_malloc(sizeof(gf_mul_table) * k * params.RecoveryCount +
+        sizeof(uint8_t*) * params.RecoveryCount);
+    if (!tables) {
+        return -3;
+    }
+    dst = (uint8_t**)(tables + k * params.RecoveryCount);
+    for (block = 0; block < params.RecoveryCount; ++block) {
+        for (j = 0; j < k; ++j) {
+            gf_mul_table_init(&tables[block * k + j], GetEncodeElement(params, block, j));
+        }
     }
 
-    /*
-        Eliminate upper right triangle.
-    */
-    for (j = N - 1; j >= 1; --j) {
-        block_j = decoder->Recovery[j]->Block;
+    // Parity is updated in groups that leave one mapping for the input, so
+    // each input page is mapped once per group
+    group = params.RecoveryCount < CAUCHY_MAX_LOCAL_MAPS - 1 ? params.RecoveryCount : CAUCHY_MAX_LOCAL_MAPS - 1;
 
-        for (i = j - 1; i >= 0; --i) {
-            block_i = decoder->Recovery[i]->Block;
-            c_ij = *matrix_U++; // Matrix elements are stored column-first, bottom-up.
+    for (pos = 0; pos < params.BlockBytes; pos += run) {
+        run = PageRun(dataBlocks, params.OriginalCount, pos, params.BlockBytes - pos);
+        run = PageRun(parityBlocks, params.RecoveryCount, pos, run);
+
+        for (first = 0; first < params.RecoveryCount; first += group) {
+            count = params.RecoveryCount - first < group ? params.RecoveryCount - first : group;
+
+            for (block = 0; block < count; ++block) {
+                dst[block] = (uint8_t*)kmap_local_page(PageAt(&parityBlocks[first + block], pos, &pageOffset)) + pageOffset;
+            }
 
-            gf_muladd_mem(block_i, c_ij, block_j, decoder->Params.BlockBytes);
+            for (j = 0; j < k; ++j) {
+                src = (uint8_t*)kmap_local_page(PageAt(&dataBlocks[j], pos, &pageOffset)) + pageOffset;
+                for (block = 0; block < count; ++block) {
+                    if (j == 0) {
+                        gf_mul_mem_table(dst[block], src, &tables[(first + block) * k], run);
+                    } else {
+                        gf_muladd_mem_table(dst[block], &tables[(first + block) * k + j], src, run);
+                    }
+                }
+                kunmap_local(src);
+            }
+
+            // Local mappings are released in reverse order
+            for (block = count - 1; block >= 0; --block) {
+                kunmap_local(dst[block]);
+            }
         }
     }
 
-    kfree(dynamicMatrix);
+    kfree(tables);
+    return 0;
 }
 
-int cauchy_rs_decode(
-    cauchy_encoder_params params, // Encoder params
-    uint8_t** dataBlocks,
-    uint8_t** parityBlocks,
+int cauchy_rs_decode_pages(
+    cauchy_encoder_params params,   // Encoder params
+    const cauchy_page_block* dataBlocks,
+    const cauchy_page_block* parityBlocks,
     uint8_t* erasures,
-    uint8_t num_erasures)         // Array of 'originalCount' blocks as described above
+    uint8_t num_erasures)
 {
-    CauchyDecoder *state = cauchy_malloc(sizeof(CauchyDecoder));
-    cauchy_block *blocks = cauchy_malloc(sizeof(cauchy_block) * params.OriginalCount);
-    int i = 0;
-
-    if (params.OriginalCount <= 0 || params.RecoveryCount <= 0 || params.BlockBytes <= 0) {
+    const int k = params.OriginalCount;
+    const cauchy_page_block* block;
+    InversePlan* plan;
+    uint8_t sorted[256], rows[256];
+    unsigned pageOffset;
+    int pos, run, i, n, ret = 0;
+
+    if (!dataBlocks || !parityBlocks || !erasures) {
+        return -3;
+    }
+    ret = CheckDecodeParams(params, erasures, num_erasures);
+    if (ret) {
+        return ret;
+    }
+    // Every input and output of a run is mapped at once
+    if (params.OriginalCount + num_erasures > CAUCHY_MAX_LOCAL_MAPS) {
         return -1;
     }
-    if (params.OriginalCount + params.RecoveryCount > 256) {
-        return -2;
+    ret = CheckPageBlocks(dataBlocks, params.OriginalCount);
+    if (!ret) {
+        ret = CheckPageBlocks(parityBlocks, num_erasures);
     }
-    if (!blocks) {
-        return -3;
+    if (ret) {
+        return ret;
     }
 
-    for(i = 0; i < params.OriginalCount; ++i){
-        blocks[i].Block = dataBlocks[i];
-        blocks[i].Index = cauchy_get_original_block_index(params, i);
+    n = SortErasures(params, erasures, num_erasures, sorted, rows);
+    if (n <= 0) {
+        return n;
     }
 
-    for(i = 0; i < num_erasures; i++){
-        blocks[erasures[i]].Block = parityBlocks[i];
-        blocks[erasures[i]].Index = cauchy_get_recovery_block_index(params, i);
+    // The matrix is solved once before anything is mapped, since the
+    // mappings may be atomic; each run only applies the plan
+    plan = InversePlanCreate(params, sorted, rows, n, NULL);
+    if (!plan) {
+        return -3;
     }
 
-    if (Initialize(state, params, blocks)) {
-        return -5;
-    }
+    // Decoding is bytewise, so each run of pages decodes on its own
+    for (pos = 0; pos < params.BlockBytes; pos += run) {
+        run = PageRun(dataBlocks, params.OriginalCount, pos, params.BlockBytes - pos);
+        run = PageRun(parityBlocks, num_erasures, pos, run);
 
-    // If nothing is erased,
-    if (state->RecoveryCount <= 0) {
-        goto done;
-    }
+        for (i = 0; i < k; ++i) {
+            block = plan->Order[i] < k ? &dataBlocks[plan->Order[i]] : &parityBlocks[plan->Order[i] - k];
+            plan->Inputs[i] = (uint8_t*)kmap_local_page(PageAt(block, pos, &pageOffset)) + pageOffset;
+        }
+        for (i = 0; i < n; ++i) {
+            plan->Outputs[i] = (uint8_t*)kmap_local_page(PageAt(&dataBlocks[sorted[i]], pos, &pageOffset)) + pageOffset;
+        }
 
-    // If m=1,
-    if (params.RecoveryCount == 1) {
-        DecodeM1(state);
-        goto done;
-    }
+        InverseApply(params, plan, run);
 
-    // Decode for m>1
-    Decode(state);
-    for(i = 0; i < params.OriginalCount; ++i){
-    //    print_hex_dump(KERN_DEBUG, "decoded: ", DUMP_PREFIX_OFFSET, 20, 1, (void*)blocks[i].Block, 16, true);
-        memcpy(dataBlocks[i], blocks[i].Block, params.BlockBytes);
+        // Local mappings are released in reverse order
+        for (i = n - 1; i >= 0; --i) {
+            kunmap_local(plan->Outputs[i]);
+        }
+        for (i = k - 1; i >= 0; --i) {
+            kunmap_local(plan->Inputs[i]);
+        }
     }
 
-done:
-    kfree(blocks);
-    kfree(state);
+    kfree(plan);
     return 0;
 }
+
+#endif // __KERNEL__
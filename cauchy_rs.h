@@ -37,6 +37,10 @@
     #include <linux/string.h>
     #include <linux/types.h>
     #include <linux/slab.h>
+    #include <linux/highmem.h>
+    #include <linux/version.h>
+    #include <linux/spinlock.h>
+    #include <linux/atomic.h>
     #include <asm/fpu/api.h>
     #define cauchy_malloc(arg) kmalloc(arg, GFP_KERNEL)
 #else
@@ -103,6 +107,9 @@ typedef char __v32qi __attribute__ ((__vector_size__ (32)));
 // Compiler-specific force inline (GCC)
 #define FORCE_INLINE inline __attribute__((always_inline))
 
+// Cache line size assumed for prefetching
+#define CAUCHY_CACHE_LINE_BYTES 64
+
 // Compiler-specific alignment keyword, only matters on ARM
 #define ALIGNED __attribute__((aligned(GF_ALIGN_BYTES)))
 
@@ -184,6 +191,31 @@ static FORCE_INLINE uint8_t gf_sqr(uint8_t x)
     return GFContext.GF_SQR_TABLE[x];
 }
 
+// Multiply tables for one constant, resolved from GFContext ahead of time
+typedef struct gf_mul_table_t {
+#ifdef GF_AVX2
+    const M256* Lo256;
+    const M256* Hi256;
+#endif
+    const M128* Lo128;
+    const M128* Hi128;
+    const uint8_t* Scalar; // GF_MUL_TABLE row for Y
+    uint8_t Y;
+} gf_mul_table;
+
+// Resolve the multiply tables for constant y
+static FORCE_INLINE void gf_mul_table_init(gf_mul_table* mul, uint8_t y)
+{
+#ifdef GF_AVX2
+    mul->Lo256 = GFContext.MM256.TABLE_LO_Y + y;
+    mul->Hi256 = GFContext.MM256.TABLE_HI_Y + y;
+#endif
+    mul->Lo128 = GFContext.MM128.TABLE_LO_Y + y;
+    mul->Hi128 = GFContext.MM128.TABLE_HI_Y + y;
+    mul->Scalar = GFContext.GF_MUL_TABLE + ((unsigned)y << 8);
+    mul->Y = y;
+}
+
 /// Performs "x[] += y[]" bulk memory XOR operation
 void gf_add_mem(void * __restrict vx, const void * __restrict vy, int bytes);
 
@@ -199,6 +231,18 @@ void gf_mul_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int
 /// Performs "z[] += x[] * y" bulk memory operation
 void gf_muladd_mem(void * __restrict vz, uint8_t y, const void * __restrict vx, int bytes);
 
+/// gf_mul_mem() with the tables for y already resolved
+void gf_mul_mem_table(void * __restrict vz, const void * __restrict vx, const gf_mul_table* mul, int bytes);
+
+/// Performs "z[] *= y" in place with the tables for y already resolved
+void gf_mul_mem_table_inplace(void * vz, const gf_mul_table* mul, int bytes);
+
+/// gf_muladd_mem() with the tables for y already resolved
+void gf_muladd_mem_table(void * __restrict vz, const gf_mul_table* mul, const void * __restrict vx, int bytes);
+
+/// Performs "z[] = w[] + x[] * y" with the tables for y already resolved
+void gf_muladdset_mem_table(void * __restrict vz, const void * __restrict vw, const gf_mul_table* mul, const void * __restrict vx, int bytes);
+
 /// Performs "x[] /= y" bulk memory operation
 static FORCE_INLINE void gf_div_mem(void * __restrict vz, const void * __restrict vx, uint8_t y, int bytes)
 {
@@ -209,12 +253,53 @@ static FORCE_INLINE void gf_div_mem(void * __restrict vz, const void * __restric
 //Initialize the encoder
 int cauchy_init(void);
 
+/*
+ * Cauchy matrix descriptor
+ *
+ * Describes the recovery matrix shared by the encoder and the decoder:
+ *
+ *    a_ij = RowScale[i] * ColScale[j] / (X[i] + Y[j])
+ *
+ * X and Y must all be distinct and the scales nonzero.  The first row must be
+ * all ones (RowScale[0] * ColScale[j] == X[0] + Y[j]) since parity 0 is
+ * generated and recovered with XOR only.  Parity written with a descriptor can
+ * only be decoded with the same descriptor.
+ */
+typedef struct cauchy_matrix_t {
+    int OriginalCount;
+    int RecoveryCount;
+    uint8_t X[256];          // Per recovery row
+    uint8_t Y[256];          // Per original column
+    uint8_t RowScale[256];   // Per recovery row
+    uint8_t ColScale[256];   // Per original column
+} cauchy_matrix;
+
+/*
+ * Codes selectable through cauchy_encoder_params.Code
+ *
+ * CAUCHY_CODE_RAID6 is P+Q as generated by the Linux md raid6 library
+ * (gen_syndrome), byte for byte: P is the XOR of the originals and
+ * Q = sum(2^i * D_i) over the 0x11d polynomial.  It needs RecoveryCount <= 2
+ * and no Matrix, and is only handled by cauchy_rs_encode() and
+ * cauchy_rs_decode(); every other entry point returns -1 for it.
+ */
+#define CAUCHY_CODE_CAUCHY 0  // Cauchy Reed-Solomon, the default
+#define CAUCHY_CODE_RAID6  1  // RAID-6 P+Q
+
 // Encoder parameters
 // block counts must be at most 256
+// Zero-initialise the whole struct, e.g. cauchy_encoder_params params = { 0 },
+// before setting fields: Matrix and Code were added later, and garbage left in
+// them by code that sets only the counts selects another matrix or code.
 typedef struct cauchy_encoder_params_t {
     int OriginalCount;
     int RecoveryCount;
     int BlockBytes;
+    // Matrix to use, or NULL for the default.  Must match the block counts
+    // and stay valid while the params (or a plan built from them) are used.
+    const cauchy_matrix* Matrix;
+    // One of the CAUCHY_CODE_* values, 0 for Cauchy
+    int Code;
 } cauchy_encoder_params;
 
 typedef struct cauchy_block_t {
@@ -241,6 +326,17 @@ static inline unsigned char cauchy_get_original_block_index(cauchy_encoder_param
 }
 
 
+/*
+ * Geometries (OriginalCount, RecoveryCount) that cauchy_rs_encode() handles
+ * with a fully unrolled encoder, for the default matrix on AVX2 machines.
+ * Override at build time to change the list, for example
+ *    make CAUCHY_GEOMETRIES="X(4,2) X(6,3)"
+ * Each needs 2..32 originals and 2..8 recovery blocks.
+ */
+#ifndef CAUCHY_FIXED_GEOMETRIES
+#define CAUCHY_FIXED_GEOMETRIES(X) X(4, 2) X(8, 3) X(10, 4)
+#endif
+
 /*
  * This produces a set of parity blocks from the original data blocks as specified
  * in the parameters structure.
@@ -275,5 +371,528 @@ int cauchy_rs_decode(
     uint8_t* erasures,            // array of erasures
     uint8_t num_erasures);        // the number of erasures
 
+/*
+ * Decode into separate output buffers
+ *
+ * Same as cauchy_rs_decode() but erased original erasures[i] is written to
+ * outBlocks[i], each params.BlockBytes long.  dataBlocks and parityBlocks are
+ * only read, so the parity stays valid for a rebuild or scrub that follows,
+ * and dataBlocks[erasures[i]] may be NULL.  Not available for
+ * CAUCHY_CODE_RAID6.
+ */
+int cauchy_rs_decode_to(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    uint8_t** parityBlocks,       // array of pointers to parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures,         // the number of erasures
+    uint8_t** outBlocks);         // output block for each erasure
+
+/*
+ * Byte-range decode for degraded reads
+ *
+ * Like cauchy_rs_decode_to() for bytes [offset, offset + bytes) of each block
+ * only.  dataBlocks and parityBlocks still point to the start of their
+ * blocks but only the window is read from them; outBlocks[i] receives the
+ * window of erasures[i] from its first byte, or is NULL if that erasure is
+ * not wanted.  Every erasure still needs its parity block, as with
+ * cauchy_rs_decode().  offset must be a multiple of GF_ALIGN_BYTES.
+ */
+int cauchy_rs_decode_range(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    uint8_t** parityBlocks,       // array of pointers to parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures,         // the number of erasures
+    int offset,                   // first byte of the window
+    int bytes,                    // bytes in the window
+    uint8_t** outBlocks);         // output window for each erasure, or NULL
+
+/*
+ * Per-sector erasure decode
+ *
+ * Blocks are split into sectors of sectorBytes, a multiple of GF_ALIGN_BYTES,
+ * the last one possibly short.  sectorMaps has OriginalCount + RecoveryCount
+ * entries, data blocks first: bit (s & 7) of sectorMaps[i][s >> 3] marks
+ * sector s of that block as bad, and a NULL map means the block is intact.
+ * A NULL parity block counts as bad throughout.
+ *
+ * Only the bad sectors of the data blocks are rewritten.  Runs of sectors
+ * with the same bad blocks are decoded together from the first intact
+ * parity rows, so different sectors may lose more than
+ * RecoveryCount blocks in total.  Returns -1 without writing anything if a
+ * sector has more bad data than intact parity.
+ */
+int cauchy_rs_decode_sectors(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    uint8_t** parityBlocks,       // array of pointers to parity blocks
+    const uint8_t* const* sectorMaps, // bad sector bitmap for each block
+    int sectorBytes);             // bytes per sector
+
+/*
+ * Decode from any parity
+ *
+ * cauchy_rs_decode() recovers erasures[i] from parity i.  This picks the
+ * parity itself from the blocks that are there, parityBlocks[i] being NULL
+ * if parity i is unavailable: the all-ones first row if it can be read, then
+ * the rows with the fewest coefficients other than 0 and 1, which are the
+ * only ones that need a multiply.  Returns -1 if fewer
+ * parity blocks are available than there are erasures.
+ */
+int cauchy_rs_decode_any(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    uint8_t** parityBlocks,       // parity blocks, NULL if unavailable
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures);        // the number of erasures
+
+/*
+ * Blocks to read to repair an erasure pattern
+ *
+ * Fills sources with the block indices, as from
+ * cauchy_get_original_block_index() and cauchy_get_recovery_block_index(),
+ * that cauchy_rs_decode_any() would read: the surviving originals and the
+ * parity it would pick.  available[i] is nonzero if parity i can be read,
+ * or available is NULL if all can.  sources needs room for OriginalCount
+ * entries.  Returns the number of blocks, 0 if nothing is erased, or -1 if
+ * the pattern cannot be repaired.
+ */
+int cauchy_rs_repair_sources(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* available,     // readable parity, or NULL for all
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures,         // the number of erasures
+    uint8_t* sources);            // output block indices
+
+/*
+ * Variable-length encode and decode
+ *
+ * blockLengths[i] is the number of valid bytes in dataBlocks[i] and may not
+ * exceed params.BlockBytes.  Shorter blocks are treated as if they were
+ * zero-padded to params.BlockBytes, but only their valid bytes are read.
+ * Parity blocks are always params.BlockBytes long.
+ *
+ * On decode the lengths of the erased blocks must be known to the caller as
+ * well, and only blockLengths[i] bytes are written back to an erased block.
+ * The parity blocks are only read.
+ */
+int cauchy_rs_encode_varlen(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    const int* blockLengths,      // Valid bytes in each original block
+    uint8_t** parityBlocks);      // Array of pointers to output parity blocks
+
+int cauchy_rs_decode_varlen(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    const int* blockLengths,      // valid bytes in each data block
+    uint8_t** parityBlocks,       // array of pointers to parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures);        // the number of erasures
+
+/*
+ * Small-block packet FEC
+ *
+ * Encodes stripeCount independent stripes that share (k, m, BlockBytes) in
+ * one call, without allocating.  The stripes are interleaved by column:
+ * the packets for original block i of every stripe are stored back to back,
+ *
+ *     data + i * cauchy_get_packet_column_bytes() + stripe * params.BlockBytes
+ *
+ * and parity uses the same layout with RecoveryCount columns.  Columns are
+ * padded to GF_ALIGN_BYTES, and data and parity must be aligned to it, as
+ * for the other entry points.  Each matrix
+ * element is then applied to all stripes in one pass over
+ * stripeCount * BlockBytes bytes, which keeps the SIMD loops full-width for
+ * packet sizes where per-call overhead would otherwise dominate.
+ */
+int cauchy_rs_encode_packets(
+    cauchy_encoder_params params, // Encoder parameters, BlockBytes per packet
+    int stripeCount,              // Number of stripes in the batch
+    const uint8_t* data,          // OriginalCount columns of stripeCount packets
+    uint8_t* parity);             // RecoveryCount columns of stripeCount packets
+
+// Bytes between the starts of two columns in the cauchy_rs_encode_packets() layout
+static inline int cauchy_get_packet_column_bytes(cauchy_encoder_params params, int stripeCount)
+{
+    return (params.BlockBytes * stripeCount + GF_ALIGN_BYTES - 1) & ~(GF_ALIGN_BYTES - 1);
+}
+
+// Address of a packet in the cauchy_rs_encode_packets() layout
+static inline uint8_t* cauchy_get_packet(cauchy_encoder_params params, int stripeCount, uint8_t* base, int blockIndex, int stripe)
+{
+    return base + (long)blockIndex * cauchy_get_packet_column_bytes(params, stripeCount)
+        + (long)stripe * params.BlockBytes;
+}
+
+/*
+ * Cache-tiled encode
+ *
+ * cauchy_rs_encode() streams all of the original blocks through the cache
+ * once per recovery block.  The tiled encoder instead splits the blocks into
+ * tileBytes slices and computes every recovery block for one slice before
+ * moving on, so each original is read from memory once.
+ *
+ * tileBytes is rounded up to a multiple of GF_ALIGN_BYTES.  Pass 0 to use
+ * cauchy_get_tile_bytes(), which sizes tiles from the detected L2 cache.
+ */
+#define CAUCHY_MIN_TILE_BYTES 1024
+
+int cauchy_get_tile_bytes(cauchy_encoder_params params);
+
+int cauchy_rs_encode_tiled(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // Array of pointers to original blocks
+    uint8_t** parityBlocks,       // Array of pointers to output parity blocks
+    int tileBytes);               // Bytes per tile, 0 for automatic
+
+/*
+ * Encoder plan
+ *
+ * Holds everything cauchy_rs_encode() recomputes on each call for a given
+ * set of parameters: the RecoveryCount x OriginalCount matrix, row-major,
+ * and the resolved multiply tables for each element in the same order.
+ * Encoding through a plan does no allocation and no matrix computation.
+ * A plan is read-only after creation and may be shared between threads.
+ *
+ * TileBytes starts out as cauchy_get_tile_bytes() and may be changed before
+ * the plan is shared.  It is rounded up to a multiple of GF_ALIGN_BYTES, as
+ * for cauchy_rs_encode_tiled(), or may be 0 to encode each recovery block in
+ * a single pass.
+ */
+typedef struct cauchy_encoder_plan_t {
+    cauchy_encoder_params Params;
+    int TileBytes;
+    uint8_t* Matrix;
+    gf_mul_table* Tables;
+} cauchy_encoder_plan;
+
+// Returns NULL if the parameters are invalid or allocation fails
+cauchy_encoder_plan* cauchy_rs_plan_create(cauchy_encoder_params params);
+void cauchy_rs_plan_free(cauchy_encoder_plan* plan);
+
+int cauchy_rs_encode_plan(
+    const cauchy_encoder_plan* plan, // Plan for the encoder parameters
+    uint8_t** dataBlocks,            // Array of pointers to original blocks
+    uint8_t** parityBlocks);         // Array of pointers to output parity blocks
+
+/*
+ * Batch encode
+ *
+ * Encodes stripeCount stripes that share the plan's parameters in one call.
+ * Validation and matrix setup are done once for the batch.  Each tile of the
+ * originals is prefetched while the one before it is encoded, running on
+ * into the first tile of the next stripe.
+ */
+typedef struct cauchy_stripe_t {
+    uint8_t** DataBlocks;   // OriginalCount pointers to original blocks
+    uint8_t** ParityBlocks; // RecoveryCount pointers to parity blocks
+} cauchy_stripe;
+
+int cauchy_rs_encode_batch(
+    const cauchy_encoder_plan* plan, // Plan for the encoder parameters
+    cauchy_stripe* stripes,          // Array of stripes to encode
+    int stripeCount);                // Number of stripes
+
+/*
+ * Streaming encode
+ *
+ * Encodes a stripe whose original blocks arrive one at a time, in any order.
+ * Each fed block is multiplied into all of the parity blocks right away, so
+ * the caller does not need to hold all of the originals in memory and the
+ * encode overlaps with receiving the rest.
+ *
+ * The parity buffers belong to the caller and are only complete once every
+ * original has been fed; cauchy_rs_stream_finalize() returns -4 otherwise.
+ * The context needs no cleanup.
+ */
+typedef struct cauchy_stream_encoder_t {
+    cauchy_encoder_params Params;
+    uint8_t** ParityBlocks;
+    int Received;
+    uint8_t ReceivedMask[32];
+} cauchy_stream_encoder;
+
+int cauchy_rs_stream_init(
+    cauchy_stream_encoder* stream, // Context to initialize
+    cauchy_encoder_params params,  // Encoder parameters
+    uint8_t** parityBlocks);       // Array of pointers to output parity blocks
+
+// Returns -4 if the block was already fed
+int cauchy_rs_stream_feed(
+    cauchy_stream_encoder* stream, // Initialized context
+    int originalIndex,             // Index of the original block
+    const uint8_t* data);          // Original block, params.BlockBytes
+
+int cauchy_rs_stream_finalize(cauchy_stream_encoder* stream);
+
+/*
+ * Parity update
+ *
+ * When some original blocks of an encoded stripe are overwritten, the parity
+ * can be brought up to date from just the changed blocks: each parity block
+ * gains element * (old + new) for every changed column, which costs O(m)
+ * block operations instead of re-reading and re-encoding the whole stripe.
+ *
+ * cauchy_rs_update() takes the old and new contents of each changed block.
+ * cauchy_rs_update_delta() takes a precomputed old XOR new instead.
+ */
+int cauchy_rs_update(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* indices,       // Indices of the changed original blocks
+    int count,                    // Number of changed blocks
+    uint8_t** oldBlocks,          // Previous contents of each changed block
+    uint8_t** newBlocks,          // New contents of each changed block
+    uint8_t** parityBlocks);      // Parity blocks, updated in place
+
+int cauchy_rs_update_delta(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* indices,       // Indices of the changed original blocks
+    int count,                    // Number of changed blocks
+    uint8_t** deltaBlocks,        // old XOR new for each changed block
+    uint8_t** parityBlocks);      // Parity blocks, updated in place
+
+/*
+ * Partial parity
+ *
+ * Parity is a sum over the original columns, so it can be computed in
+ * pieces where the originals of a stripe live on different nodes.  Each node
+ * calls cauchy_rs_encode_partial() with the columns it holds to produce
+ * RecoveryCount partial parity blocks, and a coordinator sums the shares
+ * from all nodes with cauchy_rs_combine_partial().  Every column must be
+ * covered by exactly one share.
+ */
+int cauchy_rs_encode_partial(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* indices,       // Indices of the locally held originals
+    int count,                    // Number of local originals
+    uint8_t** dataBlocks,         // The local original blocks, one per index
+    uint8_t** partialBlocks);     // Output partial parity blocks
+
+int cauchy_rs_combine_partial(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t*** shares,            // Partial parity blocks from each node
+    int shareCount,               // Number of shares
+    uint8_t** parityBlocks);      // Output parity blocks
+
+/*
+ * Strided encode and decode
+ *
+ * For stripes stored as one allocation with a fixed stride between blocks:
+ * block i starts at data + i * dataStride, and likewise for parity.  Strides
+ * must be at least params.BlockBytes and keep every block aligned to
+ * GF_ALIGN_BYTES.  Encoding needs no pointer arrays or allocation, and
+ * decoding only allocates once the survivors and the parity it reads come
+ * to more than 32 blocks.
+ */
+int cauchy_rs_encode_strided(
+    cauchy_encoder_params params, // Encoder parameters
+    const uint8_t* data,          // First original block
+    int dataStride,               // Bytes between the starts of original blocks
+    uint8_t* parity,              // First output parity block
+    int parityStride);            // Bytes between the starts of parity blocks
+
+int cauchy_rs_decode_strided(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t* data,                // First data block
+    int dataStride,               // Bytes between the starts of data blocks
+    uint8_t* parity,              // First parity block
+    int parityStride,             // Bytes between the starts of parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures);        // the number of erasures
+
+#if defined(__KERNEL__)
+/*
+ * Page array encode and decode
+ *
+ * For stripes that live in I/O pages which are not virtually contiguous.
+ * Each block is described by its array of pages and the byte offset of the
+ * block within the first page, which must be a multiple of GF_ALIGN_BYTES.
+ * Pages are mapped a run at a time with kmap_local_page() and the kernels
+ * run directly on the mapped pages, so nothing is copied or vmapped.
+ *
+ * Decode maps one page of every data block and used parity block at a time,
+ * so on highmem kernels OriginalCount + num_erasures is limited to the depth
+ * of the local mapping stack.
+ */
+typedef struct cauchy_page_block_t {
+    struct page** Pages;   // Pages holding the block, in order
+    unsigned int Offset;   // Offset of the block within Pages[0]
+} cauchy_page_block;
+
+int cauchy_rs_encode_pages(
+    cauchy_encoder_params params,          // Encoder parameters
+    const cauchy_page_block* dataBlocks,   // OriginalCount original blocks
+    const cauchy_page_block* parityBlocks); // RecoveryCount output parity blocks
+
+int cauchy_rs_decode_pages(
+    cauchy_encoder_params params,          // Encoder parameters
+    const cauchy_page_block* dataBlocks,   // OriginalCount data blocks
+    const cauchy_page_block* parityBlocks, // parity blocks
+    uint8_t* erasures,                     // array of erasures
+    uint8_t num_erasures);                 // the number of erasures
+#endif
+
+/*
+ * Cauchy matrix search
+ *
+ * Searches for a matrix for the given counts that is cheaper to multiply by
+ * than the default one: more elements equal to one (plain XOR) and fewer set
+ * bits in the bit matrices of the others.  The search is deterministic, so
+ * the same counts always give the same matrix, and never returns anything
+ * costlier than the default.  Returns NULL on bad counts or allocation
+ * failure.  Free with cauchy_matrix_free().
+ */
+cauchy_matrix* cauchy_matrix_create(
+    int originalCount,   // Number of original blocks
+    int recoveryCount);  // Number of recovery blocks
+
+void cauchy_matrix_free(cauchy_matrix* matrix);
+
+/*
+ * XOR-only encode and decode
+ *
+ * An alternative engine that never multiplies.  Each block is split into
+ * CAUCHY_XOR_PACKETS packets of BlockBytes / 8 bytes, each matrix element is
+ * expanded to the 8x8 bit matrix of multiplication by it, and every parity
+ * packet is computed as an XOR of data packets with the bulk XOR kernels.
+ * The XORs are ordered by a schedule that reuses parity packets already
+ * computed where that needs fewer XORs than starting over.
+ *
+ * The schedule depends only on the parameters, so create it once and reuse
+ * it; like an encoder plan it is read-only and may be shared between threads.
+ * XorCount gives the packet XORs it does per stripe.
+ *
+ * Parity is laid out by packet rather than by byte, so it is not the same as
+ * the output of cauchy_rs_encode() and must be decoded with
+ * cauchy_rs_decode_xor().  BlockBytes must be a multiple of
+ * CAUCHY_XOR_PACKETS * GF_ALIGN_BYTES.
+ */
+#define CAUCHY_XOR_PACKETS 8
+
+typedef struct cauchy_xor_schedule_t {
+    cauchy_encoder_params Params;
+    int InputCount;       // Blocks read
+    int OutputCount;      // Blocks written
+    int XorCount;         // Packet XORs per stripe
+    int* SourceStart;     // Per step, start of its sources, plus the end
+    uint16_t* Order;      // Per step, output packet it computes
+    uint16_t* Sources;    // Input packet, or InputCount * 8 + an output packet
+} cauchy_xor_schedule;
+
+// Returns NULL if the parameters are invalid or allocation fails
+cauchy_xor_schedule* cauchy_rs_xor_schedule_create(cauchy_encoder_params params);
+void cauchy_rs_xor_schedule_free(cauchy_xor_schedule* schedule);
+
+int cauchy_rs_encode_xor(
+    const cauchy_xor_schedule* schedule, // Schedule for the encoder parameters
+    uint8_t** dataBlocks,                // Array of pointers to original blocks
+    uint8_t** parityBlocks);             // Array of pointers to output parity blocks
+
+// Builds a schedule for the erasure pattern on each call
+int cauchy_rs_decode_xor(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // OriginalCount data blocks
+    uint8_t** parityBlocks,       // parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures);        // the number of erasures
+
+/*
+ * Decode plan cache
+ *
+ * cauchy_rs_decode() and the decoders built on it keep the matrix work for
+ * each erasure pattern (erased originals and the parity rows used for them)
+ * in a cache of CAUCHY_DECODE_CACHE_ENTRIES plans, so decoding many stripes
+ * with the same pattern only does it once.  Lookups share a read lock and
+ * the oldest entry is replaced when the cache is full.  Patterns decoded
+ * with a caller-provided Matrix are not cached.
+ *
+ * Call cauchy_rs_decode_cache_clear() to release the cached plans, for
+ * example before unloading.
+ */
+#ifndef CAUCHY_DECODE_CACHE_ENTRIES
+#define CAUCHY_DECODE_CACHE_ENTRIES 64
+#endif
+
+void cauchy_rs_decode_cache_clear(void);
+
+/*
+ * Batch decode
+ *
+ * Decodes stripeCount stripes that lost the same originals, as after a
+ * device failure.  The decoder is chosen once for the batch as in
+ * cauchy_rs_decode(): XOR for one erasure against the first parity row, the
+ * inverse for one or two erasures, and otherwise the cached plan, with the
+ * surviving originals and parity of the next stripe prefetched while the
+ * current one is decoded.  Returns -3 without decoding anything if a stripe
+ * has NULL block arrays, and stops at the first stripe that fails.
+ */
+int cauchy_rs_decode_batch(
+    cauchy_encoder_params params, // Encoder parameters
+    cauchy_stripe* stripes,       // Stripes to decode
+    int stripeCount,              // Number of stripes
+    uint8_t* erasures,            // Erasures shared by every stripe
+    uint8_t num_erasures);        // the number of erasures
+
+/*
+ * Inverse-matrix decode
+ *
+ * An alternative to cauchy_rs_decode() that inverts the small matrix of the
+ * erased originals up front, so every erased original is a direct linear
+ * combination of the surviving originals and the parity used.  Each is
+ * written straight into dataBlocks[erasure] in one pass over those inputs,
+ * and the parity blocks are left untouched.  cauchy_rs_decode() already
+ * routes one or two erasures, and decodes of a subset of the erasures, to
+ * this decoder; calling it directly forces it for larger counts, where the
+ * cached LDU plan is otherwise used.
+ */
+int cauchy_rs_decode_inverse(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t** dataBlocks,         // array of pointers to data blocks
+    uint8_t** parityBlocks,       // array of pointers to parity blocks
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures);        // the number of erasures
+
+/*
+ * Incremental decode
+ *
+ * Decodes as the surviving blocks arrive rather than once all of them are
+ * in.  Each block added is multiplied into the outputs right away with its
+ * coefficients from the inverted erasure matrix, so nothing is left to do
+ * once the last one lands.  Erased original erasures[i] is recovered from
+ * parity i into outBlocks[i], or not at all if that is NULL.
+ *
+ * Blocks are identified as by cauchy_get_original_block_index() and
+ * cauchy_get_recovery_block_index(), and may be added in any order.
+ * cauchy_rs_decoder_add() returns the number of blocks still needed, -1 for
+ * a block the decode does not use, or -4 if it was already added.  The
+ * outputs are complete when it returns 0.  Calls on one decoder must not
+ * run concurrently.
+ */
+typedef struct cauchy_decoder_t {
+    cauchy_encoder_params Params;
+    int Needed;            // Blocks still to be added
+    int OutputCount;       // Outputs computed
+    uint8_t Slot[256];     // Coefficient column for each block index, or 0xff
+    uint8_t Added[256];    // Nonzero once that block was added
+    uint8_t** Outputs;     // Output blocks
+    gf_mul_table* Tables;  // OutputCount x OriginalCount coefficients
+} cauchy_decoder;
+
+// Returns NULL if the parameters are invalid or allocation fails
+cauchy_decoder* cauchy_rs_decoder_create(
+    cauchy_encoder_params params, // Encoder parameters
+    uint8_t* erasures,            // array of erasures
+    uint8_t num_erasures,         // the number of erasures
+    uint8_t** outBlocks);         // output block for each erasure, or NULL
+
+int cauchy_rs_decoder_add(
+    cauchy_decoder* decoder,      // Decoder from cauchy_rs_decoder_create()
+    int blockIndex,               // Original or recovery block index
+    const uint8_t* block);        // Block contents, params.BlockBytes long
+
+void cauchy_rs_decoder_free(cauchy_decoder* decoder);
+
 
 #endif
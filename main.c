@@ -32,7 +32,7 @@ static inline void twodtopointer(uint8_t array[][BLOCK_BYTES], int size, uint8_t
 
 int ExampleUsage(void)
 {   
-    cauchy_encoder_params params;
+    cauchy_encoder_params params = { 0 };
     int i, j, ret;
     struct timespec timespec1, timespec2;
     //original data blocks
@@ -129,6 +129,7 @@ static int __init km_template_init(void){
 }
 
 static void __exit km_template_exit(void){
+    cauchy_rs_decode_cache_clear();
     printk(KERN_INFO "Removing kernel module\n");
 }
 